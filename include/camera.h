@@ -7,15 +7,29 @@ namespace sasi
     class Camera
     {
     public:
+        // Furthest the camera zooms out, in pixels per cell.
+        static constexpr float k_minZoom = 1.0f / 64.0f;
+
         Camera(float nearPlane, float farPlane);
 
         void getView(float* result) const;
         void getproj(float* result, int targetWidth, int targetHeight) const;
 
+        // The region of the world the projection shows on a target of the size given, in world
+        // units.
+        void getViewBounds(int targetWidth, int targetHeight, float& outMinX, float& outMinY, float& outMaxX, float& outMaxY) const;
+
+        // Zoom steps a pixel per cell at a time down to one pixel per cell, and halves or doubles
+        // below that.
         void zoomIn();
         void zoomOut();
+
+        // Pixels each cell covers on screen along an axis.
+        float getZoom() const;
         void translate(const bx::Vec3& translation);
 
+        const bx::Vec3& getLocation() const;
+
         /* Converts a screen (pixel) coordinate into a world space location based on the
            properties of this camera. */
         bx::Vec3 screenToWorldLocation(int width, int height, int x, int y) const;
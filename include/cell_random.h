@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+namespace sasi
+{
+    // Murmur3's finaliser over a seed and a world coord. Only 32-bit multiplies, xors and shifts,
+    // so loops hashing a row of cells vectorise.
+    inline uint32_t hashCell(uint32_t seed, uint32_t worldX, uint32_t worldY)
+    {
+        uint32_t hash = seed ^ (worldX * 0x9E3779B1u) ^ (worldY * 0x85EBCA77u);
+        hash ^= hash >> 16;
+        hash *= 0x85EBCA6Bu;
+        hash ^= hash >> 13;
+        hash *= 0xC2B2AE35u;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+    // Counter-based random numbers for one step of a run. Every value is a hash of the run's
+    // seed, the step and a cell's world coord and nothing else. Drawing advances no state, so
+    // threads share nothing and a cell gets the same value whatever order or thread it is
+    // ticked on. Tick functions wanting several values take different bits of the one draw.
+    class CellRandom
+    {
+    public:
+        // SplitMix64 over the seed and step picks an independent key for every step, so
+        // neighbouring steps do not draw related values for the same cell.
+        CellRandom(uint32_t seed, uint64_t step)
+        {
+            uint64_t mixed = ((static_cast<uint64_t>(seed) << 32) ^ step) + 0x9E3779B97F4A7C15ull;
+            mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ull;
+            mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBull;
+            mixed ^= mixed >> 31;
+            m_key = static_cast<uint32_t>(mixed >> 32);
+        }
+
+        inline uint32_t get(int worldX, int worldY) const
+        {
+            return hashCell(m_key, static_cast<uint32_t>(worldX), static_cast<uint32_t>(worldY));
+        }
+
+        // Writes the values of count cells of a row starting at worldX, the same ones get
+        // returns, in a loop free of branches and dependencies between cells.
+        inline void fillRow(int worldX, int worldY, int count, uint32_t* outValues) const
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                outValues[i] = hashCell(m_key, static_cast<uint32_t>(worldX + i), static_cast<uint32_t>(worldY));
+            }
+        }
+
+    private:
+        uint32_t m_key;
+    };
+}
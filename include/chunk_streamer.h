@@ -0,0 +1,245 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "particle.h"
+#include "particle_simulator.h"
+
+namespace sasi
+{
+    // A chunk's position in the world, counted in chunks from the world origin.
+    struct ChunkKey
+    {
+        int32_t x;
+        int32_t y;
+
+        bool operator==(const ChunkKey& other) const
+        {
+            return (x == other.x) && (y == other.y);
+        }
+    };
+
+    struct ChunkKeyHash
+    {
+        size_t operator()(const ChunkKey& key) const
+        {
+            return static_cast<size_t>((static_cast<uint64_t>(static_cast<uint32_t>(key.x)) << 32) | static_cast<uint32_t>(key.y))
+                * 0x9E3779B97F4A7C15ull;
+        }
+    };
+
+    // The cells of one chunk, row by row.
+    struct ChunkCells
+    {
+        static constexpr int k_cellCount = ParticleSimulator::k_chunkSize * ParticleSimulator::k_chunkSize;
+
+        ParticleType types[k_cellCount];
+        uint32_t colors[k_cellCount];
+
+        // True when every cell is void. Empty chunks are never stored, a chunk found nowhere is
+        // empty.
+        bool isEmpty() const;
+    };
+
+    // Chunks kept on disk in fixed-size slots, found through an index held in memory. The file
+    // is scratch space for one session, emptied when opened and removed when closed. Slots given
+    // up by chunks that became empty are reused. Safe to use from several threads.
+    class ChunkPageFile
+    {
+    public:
+        ChunkPageFile();
+        ~ChunkPageFile();
+
+        ChunkPageFile(const ChunkPageFile&) = delete;
+        ChunkPageFile& operator=(const ChunkPageFile&) = delete;
+
+        bool open(const std::string& path);
+        void close();
+        bool isOpen() const;
+
+        bool contains(const ChunkKey& key) const;
+
+        // Reads a stored chunk. Returns false if the chunk is not stored.
+        bool read(const ChunkKey& key, ChunkCells& outCells) const;
+
+        // Stores a chunk, or forgets it if it is empty.
+        bool write(const ChunkKey& key, const ChunkCells& cells);
+
+        size_t getChunkCount() const;
+
+    private:
+        std::string m_path;
+        int m_file;
+        std::unordered_map<ChunkKey, uint64_t, ChunkKeyHash> m_slots;
+        std::vector<uint64_t> m_freeSlots;
+        uint64_t m_slotCount;
+        mutable std::mutex m_mutex;
+    };
+
+    // Chunks that recently left the resident region, held in memory in front of the page file.
+    // Once over capacity the least recently used chunk is written out to the page file. Safe to
+    // use from several threads.
+    class ChunkCache
+    {
+    public:
+        ChunkCache(size_t capacity, ChunkPageFile& pageFile);
+
+        ChunkCache(const ChunkCache&) = delete;
+        ChunkCache& operator=(const ChunkCache&) = delete;
+
+        // Hands a chunk over to the cache. Empty chunks are dropped from the cache and page file.
+        void put(const ChunkKey& key, const ChunkCells& cells);
+
+        // Moves a chunk out of the cache, or reads it from the page file when the cache does not
+        // hold it, and reports which. Returns false if neither has it, in which case the chunk
+        // is empty.
+        bool take(const ChunkKey& key, ChunkCells& outCells, bool& outWasCached);
+
+        // Reads a chunk from the page file into the cache ahead of a take, unless the cache
+        // holds it already. The file is read without holding up the other calls.
+        void prefetch(const ChunkKey& key);
+
+        size_t getSize() const;
+
+    private:
+        struct Entry
+        {
+            ChunkKey key;
+            std::unique_ptr<ChunkCells> cells;
+        };
+
+        // Inserts a chunk as the most recently used one and writes out what no longer fits.
+        // Expects the mutex to be held.
+        void insert(const ChunkKey& key, std::unique_ptr<ChunkCells> cells);
+
+    private:
+        size_t m_capacity;
+        ChunkPageFile& m_pageFile;
+
+        // Most recently used first.
+        std::list<Entry> m_entries;
+        std::unordered_map<ChunkKey, std::list<Entry>::iterator, ChunkKeyHash> m_lookup;
+
+        // Bumped by every put, so a prefetch can tell a newer copy may have reached the page
+        // file while it was reading.
+        uint64_t m_putCount;
+
+        mutable std::mutex m_mutex;
+    };
+
+    struct StreamingOptions
+    {
+        // Scratch file chunks are paged out to, see ChunkPageFile.
+        std::string pageFilePath = "world.pages";
+
+        // Chunks outside the resident region kept in memory before paging out to disk.
+        size_t cacheCapacity = 256;
+
+        // How many chunks the focus may stray from the centre of the resident region before the
+        // region follows it. Keeps a focus hovering over a chunk border from paging back and forth.
+        int recentreMargin = 2;
+
+        // How far ahead the focus' motion is extrapolated to choose chunks to prefetch.
+        double prefetchLookaheadSecs = 0.5;
+    };
+
+    struct StreamingStats
+    {
+        // Chunk the resident region's top left corner stands for.
+        int originChunkX = 0;
+        int originChunkY = 0;
+
+        size_t cachedChunks = 0u;
+        size_t pagedChunks = 0u;
+
+        // Times the resident region has moved, and chunks brought in that the prefetch had
+        // already read into the cache or that were still there from an earlier visit.
+        uint64_t regionMoves = 0u;
+        uint64_t chunksPagedIn = 0u;
+        uint64_t chunksFromCache = 0u;
+    };
+
+    // Turns a fixed-size simulator into a window over an unbounded world. The grid is the
+    // resident region and is kept centred on a focus point, usually the camera. When the focus
+    // strays the grid scrolls by whole chunks: chunks leaving it go to a ChunkCache backed by a
+    // ChunkPageFile, and chunks entering it come back from there. A background thread prefetches
+    // chunks the focus is heading towards, so memory stays bounded by the grid plus the cache
+    // while disk reads mostly happen off the simulation thread. The grid size must be a whole
+    // number of chunks.
+    class ChunkStreamer
+    {
+    public:
+        ChunkStreamer(ParticleSimulator& simulator, const StreamingOptions& options);
+        ~ChunkStreamer();
+
+        ChunkStreamer(const ChunkStreamer&) = delete;
+        ChunkStreamer& operator=(const ChunkStreamer&) = delete;
+
+        // False when the page file could not be opened or the grid is not a whole number of
+        // chunks, in which case the streamer leaves the simulator alone.
+        bool isEnabled() const;
+
+        // Moves the point the resident region follows, in world cells.
+        void setFocus(float cellX, float cellY);
+
+        // Scrolls the resident region after the focus if it strayed far enough, and queues
+        // prefetches along its path. Returns true if the region moved. Must not be called
+        // during a step.
+        bool update();
+
+        StreamingStats getStats() const;
+
+    private:
+        // Scrolls the resident region by whole chunks, paging out the chunks it leaves and in
+        // the ones it reaches.
+        void moveRegion(int chunksX, int chunksY);
+
+        // Origin chunk that centres the resident region on a world cell.
+        void centreOriginOn(float cellX, float cellY, int& outChunkX, int& outChunkY) const;
+
+        // Queues the chunks of a region at the origin given that are not resident, replacing any
+        // the prefetch thread has not reached yet.
+        void queuePrefetch(int originChunkX, int originChunkY);
+
+        void prefetchLoop();
+
+    private:
+        ParticleSimulator& m_simulator;
+        StreamingOptions m_options;
+        ChunkPageFile m_pageFile;
+        ChunkCache m_cache;
+        bool m_isEnabled;
+
+        int m_regionChunksX;
+        int m_regionChunksY;
+
+        float m_focusX;
+        float m_focusY;
+        float m_focusVelocityX;
+        float m_focusVelocityY;
+        std::chrono::steady_clock::time_point m_focusTime;
+        bool m_hasFocus;
+
+        uint64_t m_regionMoves;
+        uint64_t m_chunksPagedIn;
+        uint64_t m_chunksFromCache;
+
+        // Chunks handed to the prefetch thread, taken from the back.
+        std::vector<ChunkKey> m_prefetchQueue;
+        std::mutex m_prefetchMutex;
+        std::condition_variable m_prefetchWake;
+        bool m_isQuitting;
+        std::thread m_prefetchThread;
+
+        std::unique_ptr<ChunkCells> m_scratch;
+    };
+}
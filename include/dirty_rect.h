@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <vector>
+
+namespace sasi
+{
+    // An inclusive rectangle of cells. A rect with min > max is empty.
+    struct DirtyRect
+    {
+        DirtyRect()
+            : minX(std::numeric_limits<int>::max())
+            , minY(std::numeric_limits<int>::max())
+            , maxX(std::numeric_limits<int>::min())
+            , maxY(std::numeric_limits<int>::min())
+        {
+        }
+
+        DirtyRect(int _minX, int _minY, int _maxX, int _maxY)
+            : minX(_minX)
+            , minY(_minY)
+            , maxX(_maxX)
+            , maxY(_maxY)
+        {
+        }
+
+        bool isEmpty() const
+        {
+            return (minX > maxX) || (minY > maxY);
+        }
+
+        int getWidth() const
+        {
+            return isEmpty() ? 0 : (maxX - minX + 1);
+        }
+
+        int getHeight() const
+        {
+            return isEmpty() ? 0 : (maxY - minY + 1);
+        }
+
+        long long getArea() const
+        {
+            return static_cast<long long>(getWidth()) * getHeight();
+        }
+
+        void expand(int _minX, int _minY, int _maxX, int _maxY)
+        {
+            minX = std::min(minX, _minX);
+            minY = std::min(minY, _minY);
+            maxX = std::max(maxX, _maxX);
+            maxY = std::max(maxY, _maxY);
+        }
+
+        int minX;
+        int minY;
+        int maxX;
+        int maxY;
+    };
+
+    // Merges rects that touch or overlap in place, but only where the merged bounding box wastes
+    // little area on unchanged cells. Expects rects in row-major order of their top-left corner,
+    // as produced by walking chunks, and keeps that order.
+    void mergeDirtyRects(std::vector<DirtyRect>& rects);
+
+    // A dirty rect that can be expanded from several threads at once without locking. Expanding
+    // a rect that already covers the region only performs loads.
+    struct AtomicDirtyRect
+    {
+        AtomicDirtyRect()
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            const DirtyRect empty{};
+            minX.store(empty.minX, std::memory_order_relaxed);
+            minY.store(empty.minY, std::memory_order_relaxed);
+            maxX.store(empty.maxX, std::memory_order_relaxed);
+            maxY.store(empty.maxY, std::memory_order_relaxed);
+        }
+
+        DirtyRect load() const
+        {
+            return DirtyRect{
+                minX.load(std::memory_order_relaxed),
+                minY.load(std::memory_order_relaxed),
+                maxX.load(std::memory_order_relaxed),
+                maxY.load(std::memory_order_relaxed) };
+        }
+
+        void expand(int _minX, int _minY, int _maxX, int _maxY)
+        {
+            lower(minX, _minX);
+            lower(minY, _minY);
+            raise(maxX, _maxX);
+            raise(maxY, _maxY);
+        }
+
+        std::atomic<int> minX;
+        std::atomic<int> minY;
+        std::atomic<int> maxX;
+        std::atomic<int> maxY;
+
+    private:
+        static void lower(std::atomic<int>& value, int candidate)
+        {
+            int current = value.load(std::memory_order_relaxed);
+            while ((candidate < current) && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        static void raise(std::atomic<int>& value, int candidate)
+        {
+            int current = value.load(std::memory_order_relaxed);
+            while ((candidate > current) && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed))
+            {
+            }
+        }
+    };
+}
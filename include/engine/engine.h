@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 
 #include <bgfx/bgfx.h>
 #include <SDL2/SDL.h>
@@ -29,16 +30,37 @@ namespace sasi
     class Engine
     {
     public:
-        Engine(int initWidth, int initHeight);
+        // The window starts at initWidth by initHeight pixels and the world at worldWidth by
+        // worldHeight cells.
+        Engine(int initWidth, int initHeight, int worldWidth, int worldHeight);
         ~Engine();
 
         bool tick();
 
         bool isInitialized() const;
 
+        // Starts streaming per-step simulation metrics to a CSV file.
+        void openMetricsCsv(const std::string& path);
+
+        // Replaces the world with a snapshot.
+        void loadSnapshot(const std::string& path);
+
+        // Streams an unbounded world around the camera, paging distant chunks to a file.
+        void enableStreaming(const std::string& pageFilePath);
+
+        // Loads material definitions, painted with the 4 key.
+        bool loadMaterials(const std::string& path);
+
+        // Records brush input to a file, or replays a recording in place of live input.
+        void startRecording(const std::string& path);
+        bool startReplay(const std::string& path);
+
     private:
         void pollEvents();
 
+        // Writes the simulation metrics below the resolution stats, starting at the given row.
+        void printMetrics(uint16_t row) const;
+
     private:
         uint64_t m_frame;
         bool m_isInitialized;
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+
+namespace sasi
+{
+    struct SchedulerOptions
+    {
+        // Simulated seconds covered by one step.
+        double fixedDeltaTime = 1.0 / 30.0;
+
+        // Wall clock time the steps of one update may take. Steps past it are deferred to the
+        // next update, though every update runs at least one step.
+        double updateBudgetSecs = 1.0 / 60.0;
+
+        // Most steps one update runs, however far behind the simulation is.
+        int maxStepsPerUpdate = 4;
+
+        // Most due steps carried into the next update. Anything beyond is dropped, so an
+        // overloaded simulation slows down instead of falling further and further behind.
+        int maxDeferredSteps = 8;
+
+        // Stretches the wall clock time between steps while steps cost more than maxStepLoad
+        // of it. Every step still simulates fixedDeltaTime, the world just runs in slow motion.
+        bool adaptStepRate = false;
+        double maxStepLoad = 0.9;
+        double minTimeScale = 0.25;
+    };
+
+    struct SchedulerStats
+    {
+        // Steps run by the last update.
+        int stepsLastUpdate = 0;
+
+        // Steps that were due at the end of the last update but left for later.
+        int deferredSteps = 0;
+
+        // Steps dropped since the scheduler was created.
+        uint64_t droppedSteps = 0ull;
+
+        // Simulated seconds per wall clock second while the simulation keeps up.
+        double timeScale = 1.0;
+
+        // Running average of the wall clock time a step takes.
+        double averageStepSecs = 0.0;
+    };
+
+    // Decides when fixed steps run against the wall clock. The caller feeds it elapsed time,
+    // asks it before every step whether to run one and tells it how long each took.
+    class FixedStepScheduler
+    {
+    public:
+        explicit FixedStepScheduler(const SchedulerOptions& options);
+
+        // Adds wall clock time that passed since the last call.
+        void advance(double elapsedSecs);
+
+        // Wall clock time until the next step is due, zero when one is due now.
+        double getTimeUntilNextStep() const;
+
+        // Whether the current update should run another step, given the wall clock time its
+        // steps have taken so far.
+        bool shouldStep(double updateElapsedSecs) const;
+
+        void onStepFinished(double stepSecs);
+
+        // Ends the current update. Drops backlog beyond the deferral cap and adapts the step
+        // rate when enabled.
+        void finishUpdate();
+
+        const SchedulerStats& getStats() const;
+        double getFixedDeltaTime() const;
+
+    private:
+        SchedulerOptions m_options;
+        SchedulerStats m_stats;
+
+        double m_accumulationSecs;
+        double m_stepIntervalSecs;
+        int m_stepsThisUpdate;
+    };
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "particle.h"
+#include "particle_simulator.h"
+
+namespace sasi
+{
+
+    enum class InputEventKind : uint8_t
+    {
+        // Places one particle at a world location.
+        PlaceParticle = 0,
+
+        // Fills a disc of the event's radius around the world location.
+        FillCircle,
+
+        // Fills the rect between the world location and the second location.
+        FillRect,
+
+        // Fills every cell within the event's radius of the line from the world location to the
+        // second location, like a brush dragged between two frames.
+        Stroke,
+    };
+
+    // An edit to the world, applied between two steps.
+    struct InputEvent
+    {
+        // Steps run since recording started when the event was applied.
+        uint64_t step = 0ull;
+
+        // Wall clock time since recording started when the event was applied, in microseconds.
+        uint64_t timeUs = 0ull;
+
+        InputEventKind kind = InputEventKind::PlaceParticle;
+        ParticleType particleType = ParticleType::Void;
+        float worldX = 0.0f;
+        float worldY = 0.0f;
+
+        // Used by the bulk edits only, see ParticleSimulator::fillLine. The radius is in world
+        // units.
+        float toWorldX = 0.0f;
+        float toWorldY = 0.0f;
+        float radius = 0.0f;
+        float density = 1.0f;
+        uint32_t seed = 0u;
+    };
+
+    // Applies an event to the simulator. Gives the same result every time for the same world.
+    void applyInputEvent(ParticleSimulator& simulator, const InputEvent& event);
+
+    // Everything besides its events that a recorded session's outcome depends on. A replay
+    // only repeats the session on a simulator set up the same way, starting from the same
+    // cells at the same step.
+    struct RecordingSetup
+    {
+        int width = 0;
+        int height = 0;
+        double fixedDeltaTime = 0.0;
+
+        // Simulator step the first recorded step ran at.
+        uint64_t startStep = 0ull;
+
+        uint32_t randomSeed = 0u;
+        SimulationBackend backend = SimulationBackend::CellScan;
+
+        // The cell scan's checkerboard update moves particles in another order than its single
+        // threaded scan, though the same for any number of threads above one.
+        bool isCheckerboard = false;
+
+        VelocityOptions velocity;
+
+        // Brushes are recorded as particle type ids, so the materials registered on top of the
+        // built-in types must be the same ones, in the same order. The names are only kept to
+        // tell which were missing.
+        std::vector<std::string> materialNames;
+        uint64_t materialDigest = 0ull;
+    };
+
+    // Describes a simulator as it is between two steps.
+    RecordingSetup describeRecordingSetup(const ParticleSimulator& simulator, double fixedDeltaTime);
+
+    // Returns false, logging what differs, if the simulator would play out the recording's
+    // events differently from the session that recorded them. Cells and step are not compared.
+    bool matchesRecordingSetup(const RecordingSetup& setup, const ParticleSimulator& simulator);
+
+    // Recordings are started on a live world, whose cells are saved to a snapshot at this path
+    // next to the recording. Replays start from it.
+    std::string getRecordingStartPath(const std::string& recordingPath);
+
+    // Writes input events to a compact binary file. After a header holding the version and the
+    // session's RecordingSetup, each event takes a kind and a particle type byte, the step and
+    // time as varint deltas from the previous event, and the location as two floats. Bulk
+    // edits follow that with the second location, radius and density as floats and the seed
+    // as a varint.
+    class InputRecorder
+    {
+    public:
+        InputRecorder();
+
+        // Starts a recording, replacing the file's contents. Returns false if it could not be
+        // opened.
+        bool open(const std::string& path, const RecordingSetup& setup);
+        void close();
+        bool isOpen() const;
+
+        // Events must arrive in step order.
+        void record(const InputEvent& event);
+
+    private:
+        std::ofstream m_file;
+        uint64_t m_previousStep;
+        uint64_t m_previousTimeUs;
+    };
+
+    // A recording read back into memory, handing out its events at the steps they were applied.
+    class InputReplay
+    {
+    public:
+        InputReplay();
+
+        // Reads a whole recording. Returns false, leaving the replay empty, if the file is
+        // missing or malformed.
+        bool load(const std::string& path);
+
+        int getWidth() const;
+        int getHeight() const;
+        double getFixedDeltaTime() const;
+        const RecordingSetup& getSetup() const;
+
+        // Step of the last event, zero for a recording without events.
+        uint64_t getLastStep() const;
+        const std::vector<InputEvent>& getEvents() const;
+
+        // Applies the events recorded for the step, which must not be earlier than the step
+        // given to the previous call. Returns how many were applied.
+        int applyEventsForStep(uint64_t step, ParticleSimulator& simulator);
+
+        bool isFinished() const;
+
+    private:
+        std::vector<InputEvent> m_events;
+        size_t m_nextEvent;
+
+        RecordingSetup m_setup;
+    };
+}
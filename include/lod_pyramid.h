@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "dirty_rect.h"
+#include "particle.h"
+
+namespace sasi
+{
+    // Downsampled copies of the colour data and type plane for drawing the world zoomed out,
+    // each level half the size of the one below on both axes. Level 0 is the full resolution
+    // planes themselves, which the pyramid reads but does not keep. Levels are brought up to
+    // date one changed region at a time, so keeping them costs about a third of the cells
+    // changed on top of the changes themselves.
+    class LodPyramid
+    {
+    public:
+        LodPyramid(int width, int height, int levelCount);
+
+        int getLevelCount() const;
+        int getLevelWidth(int level) const;
+        int getLevelHeight(int level) const;
+
+        // Planes of a level above 0, rows getLevelWidth(level) cells apart. A level's colour is
+        // the average of the four below it and its type the first of them that is not void, so
+        // scattered particles stay visible.
+        const uint32_t* getColors(int level) const;
+        const ParticleType* getTypes(int level) const;
+
+        // Recomputes every cell above level 0 built from a region of the full resolution
+        // planes, which are given with rows stride cells apart.
+        void update(const uint32_t* colors, const ParticleType* types, int stride, const DirtyRect& rect);
+
+        // The cells of a level built from a region of level 0.
+        static DirtyRect toLevel(const DirtyRect& rect, int level);
+
+    private:
+        struct Level
+        {
+            int width;
+            int height;
+            std::unique_ptr<uint32_t[]> colors;
+            std::unique_ptr<ParticleType[]> types;
+        };
+
+        // Level 0 only holds its size.
+        std::vector<Level> m_levels;
+    };
+}
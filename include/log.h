@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Log calls below this level compile to nothing: 0 keeps debug logs, 1 info, 2 warnings and 3
+// errors only. Set through LOG_LEVEL in the Makefile.
+#ifndef SASI_LOG_MIN_LEVEL
+#define SASI_LOG_MIN_LEVEL 1
+#endif
+
+namespace sasi
+{
+    enum class LogLevel : uint8_t
+    {
+        Debug = 0,
+        Info,
+        Warning,
+        Error,
+    };
+
+    // Rate limiting state of one log call site, a static the logging macros declare for each.
+    struct LogSite
+    {
+        // Start of the current one second window in steady clock milliseconds, messages logged
+        // in it and messages dropped by the limit since the site last got through.
+        std::atomic<int64_t> windowStartMs{ 0 };
+        std::atomic<uint32_t> windowCount{ 0u };
+        std::atomic<uint32_t> suppressedCount{ 0u };
+    };
+
+    // Formats a message and queues it for the logging thread, which writes it to stdout with the
+    // usual "SASI (LEVEL): " prefix. Each site gets through a handful of times a second, past
+    // that its messages are counted and the count is reported with the next one let through.
+    // Never blocks: the queue is a fixed ring buffer, lock-free for any number of threads, and
+    // messages that find it full are dropped and counted. Prefer the SASI_LOG_* macros, which
+    // declare the site and strip levels below SASI_LOG_MIN_LEVEL.
+    void logMessage(LogSite& site, LogLevel level, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+    // Messages below this level are dropped at run time. Defaults to Info.
+    void setLogLevel(LogLevel level);
+
+    // Waits until every message queued so far has been written. Useful before exiting, or
+    // before writing to stdout directly.
+    void flushLog();
+}
+
+#define SASI_LOG(level, ...) \
+    do \
+    { \
+        static ::sasi::LogSite sasiLogSite; \
+        ::sasi::logMessage(sasiLogSite, level, __VA_ARGS__); \
+    } while (false)
+
+#if SASI_LOG_MIN_LEVEL <= 0
+#define SASI_LOG_DEBUG(...) SASI_LOG(::sasi::LogLevel::Debug, __VA_ARGS__)
+#else
+#define SASI_LOG_DEBUG(...) do { } while (false)
+#endif
+
+#if SASI_LOG_MIN_LEVEL <= 1
+#define SASI_LOG_INFO(...) SASI_LOG(::sasi::LogLevel::Info, __VA_ARGS__)
+#else
+#define SASI_LOG_INFO(...) do { } while (false)
+#endif
+
+#if SASI_LOG_MIN_LEVEL <= 2
+#define SASI_LOG_WARNING(...) SASI_LOG(::sasi::LogLevel::Warning, __VA_ARGS__)
+#else
+#define SASI_LOG_WARNING(...) do { } while (false)
+#endif
+
+#define SASI_LOG_ERROR(...) SASI_LOG(::sasi::LogLevel::Error, __VA_ARGS__)
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "particle.h"
+
+namespace sasi
+{
+    // What a rule lets a particle do with its target cell.
+    enum class MaterialRuleKind : uint8_t
+    {
+        // Move into the cell if it is void.
+        Move,
+
+        // Move into the cell if it is void, or swap with the fluid there if it is lighter.
+        Sink,
+
+        // Swap with the fluid in the cell if it is heavier. Never enters void.
+        Float,
+    };
+
+    struct MaterialOffset
+    {
+        int dx;
+        int dy;
+    };
+
+    struct MaterialRule
+    {
+        MaterialRuleKind kind = MaterialRuleKind::Move;
+
+        // Neighbours the rule may send the particle to, within the tick reach. The first one
+        // that accepts the particle is taken.
+        std::vector<MaterialOffset> offsets;
+
+        // Tries the offsets starting from a random one each step instead of the first, so
+        // materials do not drift towards whichever side is listed first.
+        bool isRandom = false;
+    };
+
+    // A material as written in a definition file. Its rules are tried in the order given every
+    // step and the first that applies moves the particle. A material without rules never moves,
+    // though others may still displace it if it is a fluid.
+    struct MaterialDefinition
+    {
+        std::string name;
+        uint32_t color = 0xFFFFFFFF;
+
+        // Decides which fluids a Sink rule passes through and which a Float rule rises through.
+        int density = 0;
+
+        // Fluids can be displaced by other materials' Sink and Float rules.
+        bool isFluid = false;
+
+        std::vector<MaterialRule> rules;
+    };
+
+    // Parses material definitions. Lines starting with '#' and blank lines are skipped.
+    // Everything else belongs to the material started by the last "material" line:
+    //
+    //     material oil
+    //     color FF1F3F5F             # ABGR, like particle colours
+    //     density 800
+    //     fluid
+    //     sink 0 1                   # rules: move, sink or float, then dx dy pairs
+    //     sink random -1 1 1 1       # random starts from a random pair each step
+    //
+    // Logs the first error along with its line and returns false.
+    bool parseMaterialDefinitions(const std::string& text, const std::string& sourceName, std::vector<MaterialDefinition>& outDefinitions);
+    bool loadMaterialDefinitions(const std::string& path, std::vector<MaterialDefinition>& outDefinitions);
+
+    // What a particle does with a rule's target cell, looked up by the type in that cell.
+    enum class RuleAction : uint8_t
+    {
+        None,
+        Move,
+        Swap,
+    };
+
+    // A rule flattened for the tick: its offsets in fixed arrays and the action for every type
+    // of target cell in a shared table.
+    struct CompiledRule
+    {
+        static constexpr int k_maxOffsets = 8;
+
+        int8_t dx[k_maxOffsets];
+        int8_t dy[k_maxOffsets];
+        uint8_t offsetCount;
+        bool isRandom;
+        uint16_t actionTable;
+    };
+
+    // Every defined material's rules compiled into dense tables indexed by type, so one generic
+    // kernel can run any of them without branching on the material. Built-in types take part
+    // in density comparisons but keep their own kernels.
+    class MaterialTable
+    {
+    public:
+        static constexpr int k_maxTypes = static_cast<int>(ParticleType::Max) + 1;
+        static constexpr int k_maxRules = 8;
+
+        MaterialTable();
+
+        // Defines a material under a type id and recompiles the rules of every material, since
+        // which fluids each can displace depends on the densities of all of them. Returns false,
+        // defining nothing, if the definition breaks a limit of the tables.
+        bool define(ParticleType type, const MaterialDefinition& definition);
+
+        inline bool isDefined(ParticleType type) const
+        {
+            return m_isDefined[static_cast<uint8_t>(type)];
+        }
+
+        inline uint32_t getColor(ParticleType type) const
+        {
+            return m_colors[static_cast<uint8_t>(type)];
+        }
+
+        // The rules of a material in priority order.
+        inline const CompiledRule* getRules(ParticleType type, int& outCount) const
+        {
+            outCount = m_ruleCounts[static_cast<uint8_t>(type)];
+            return m_rules.data() + m_firstRules[static_cast<uint8_t>(type)];
+        }
+
+        inline const RuleAction* getActions(const CompiledRule& rule) const
+        {
+            return m_actionTables[rule.actionTable].data();
+        }
+
+        // Finds a material by name. Returns ParticleType::Max if there is none.
+        ParticleType findType(const std::string& name) const;
+
+        // Materials in the order they were defined.
+        const std::vector<MaterialDefinition>& getDefinitions() const;
+
+        // Hashes every definition with the type it was given, so two tables digest the same
+        // only if they make particles behave the same.
+        uint64_t getDigest() const;
+
+    private:
+        void compile();
+
+    private:
+        std::array<bool, k_maxTypes> m_isDefined;
+        std::array<uint32_t, k_maxTypes> m_colors;
+
+        // Density and fluidity every type shows to the rules of others.
+        std::array<int, k_maxTypes> m_densities;
+        std::array<bool, k_maxTypes> m_isFluid;
+
+        std::array<uint16_t, k_maxTypes> m_firstRules;
+        std::array<uint8_t, k_maxTypes> m_ruleCounts;
+        std::vector<CompiledRule> m_rules;
+
+        // Shared between rules of the same kind and density.
+        std::vector<std::array<RuleAction, k_maxTypes>> m_actionTables;
+
+        std::vector<ParticleType> m_definedTypes;
+        std::vector<MaterialDefinition> m_definitions;
+    };
+}
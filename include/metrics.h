@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace sasi
+{
+    // What one simulation step did and how long its phases took.
+    struct StepMetrics
+    {
+        // Wall clock time spent ticking particles and copying colours, in seconds.
+        double tickSecs = 0.0;
+        double colorSecs = 0.0;
+
+        // Particles whose tick function ran, and how many of them left their cell.
+        uint32_t particlesTicked = 0u;
+        uint32_t particlesMoved = 0u;
+
+        // Chunks with cells to simulate.
+        uint32_t activeChunks = 0u;
+    };
+
+    struct MetricSummary
+    {
+        double p50 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+    };
+
+    // Percentiles over the most recent steps and updates seen by a MetricsRecorder.
+    struct MetricsSummary
+    {
+        MetricSummary tickMs;
+        MetricSummary colorMs;
+        MetricSummary particlesTicked;
+        MetricSummary particlesMoved;
+        MetricSummary activeChunks;
+        MetricSummary stepsPerUpdate;
+
+        // Steps recorded since the recorder was created.
+        uint64_t stepCount = 0ull;
+    };
+
+    // Fixed number of the most recent samples of one metric.
+    class RollingWindow
+    {
+    public:
+        explicit RollingWindow(size_t capacity);
+
+        void add(double sample);
+
+        // Uses scratch to avoid reordering the window. Returns zeros while it is empty.
+        MetricSummary summarize(std::vector<double>& scratch) const;
+
+    private:
+        std::vector<double> m_samples;
+        size_t m_capacity;
+        size_t m_next;
+    };
+
+    // Keeps rolling windows of step metrics and optionally streams every step to a CSV file.
+    // Not thread safe, keep it on the thread that runs the steps.
+    class MetricsRecorder
+    {
+    public:
+        explicit MetricsRecorder(size_t windowSize = 256);
+
+        // Starts writing one row per step to the file, replacing its contents. Returns false if
+        // the file could not be opened.
+        bool openCsv(const std::string& path);
+
+        void recordStep(const StepMetrics& metrics);
+
+        // Ends an update, a batch of steps run back to back, which ran the given number of steps.
+        void recordUpdate(int stepsRun);
+
+        MetricsSummary summarize();
+
+    private:
+        RollingWindow m_tickMs;
+        RollingWindow m_colorMs;
+        RollingWindow m_particlesTicked;
+        RollingWindow m_particlesMoved;
+        RollingWindow m_activeChunks;
+        RollingWindow m_stepsPerUpdate;
+
+        std::vector<double> m_scratch;
+        std::ofstream m_csv;
+
+        uint64_t m_stepCount;
+        uint64_t m_updateCount;
+    };
+}
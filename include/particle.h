@@ -5,7 +5,8 @@
 
 namespace sasi
 {
-    enum class ParticleType : uint32_t
+    // Stored as a single byte per cell in the simulator's type plane.
+    enum class ParticleType : uint8_t
     {
         Void = 0,
         OutOfBounds,
@@ -13,27 +14,34 @@ namespace sasi
         Sand,
         Water,
 
-        Max = std::numeric_limits<uint32_t>::max()
+        Max = std::numeric_limits<uint8_t>::max()
     };
 
+    // A view of a single cell. The simulator does not store particles like this, it keeps each
+    // field in its own plane and assembles a particle on request.
     struct Particle
     {
         Particle()
             : type(ParticleType::Void)
             , color(0x000000)
-            , lastTickFrame(0ull)
         {
         }
 
         Particle(ParticleType _type, uint32_t _color)
             : type(_type)
             , color(_color)
-            , lastTickFrame(0ull)
         {
         }
 
         ParticleType type;
         uint32_t color;
-        uint64_t lastTickFrame;
+    };
+
+    // Cells per step a particle travels along each axis. Only kept when the simulator is made
+    // with velocities enabled, in a plane of its own beside the cells.
+    struct Velocity
+    {
+        float x = 0.0f;
+        float y = 0.0f;
     };
 }
\ No newline at end of file
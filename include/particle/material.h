@@ -0,0 +1,55 @@
+#pragma once
+
+#include "material_rules.h"
+#include "particle.h"
+#include "particle_simulator.h"
+
+// The one kernel behind every material loaded from a definition file. It walks the material's
+// compiled rules in priority order and takes the first neighbour whose type the rule's action
+// table accepts, so a new material costs table entries rather than code.
+inline void materialTick(sasi::ParticleSimulator* simulator, const sasi::MaterialTable& materials, int x, int y, sasi::ParticleType type)
+{
+    const sasi::CellCursor cell = simulator->getCursor(x, y);
+
+    int ruleCount = 0;
+    const sasi::CompiledRule* rules = materials.getRules(type, ruleCount);
+    uint32_t random = 0u;
+    bool hasRandom = false;
+    for (int i = 0; i < ruleCount; ++i)
+    {
+        const sasi::CompiledRule& rule = rules[i];
+        const sasi::RuleAction* actions = materials.getActions(rule);
+
+        // Random rules start from a different offset each, drawn from their own bits of one
+        // value per cell and step.
+        int offset = 0;
+        if (rule.isRandom)
+        {
+            if (!hasRandom)
+            {
+                random = simulator->getCellRandom(x, y);
+                hasRandom = true;
+            }
+            offset = static_cast<int>((random >> ((i * 4) & 31)) % rule.offsetCount);
+        }
+
+        for (int tried = 0; tried < rule.offsetCount; ++tried)
+        {
+            const int dx = rule.dx[offset];
+            const int dy = rule.dy[offset];
+            switch (actions[static_cast<uint8_t>(cell.getType(dx, dy))])
+            {
+            case sasi::RuleAction::Move:
+                cell.move(dx, dy, simulator->make(sasi::ParticleType::Void));
+                return;
+            case sasi::RuleAction::Swap:
+                cell.swap(dx, dy);
+                return;
+            case sasi::RuleAction::None:
+                break;
+            }
+
+            offset = (offset + 1 == rule.offsetCount) ? 0 : offset + 1;
+        }
+    }
+}
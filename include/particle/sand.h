@@ -1,42 +1,62 @@
 #pragma once
 
 #include "particle.h"
+#include "particle_registry.h"
 #include "particle_simulator.h"
 
-sasi::Particle sandMake(const sasi::ParticleSimulator* simulator)
+#include "particle/velocity.h"
+
+inline sasi::Particle sandMake(const sasi::ParticleSimulator* simulator)
 {
     return sasi::Particle{ sasi::ParticleType::Sand, 0xFF00FFFF };
 }
 
-void sandTick(sasi::ParticleSimulator* simulator, sasi::Particle& particle, int x, int y)
+inline void sandTick(sasi::ParticleSimulator* simulator, int x, int y)
 {
-    // If the cell below is free, move into it.
-    const sasi::Particle& below = simulator->getParticle(x, y + 1);
-    if (below.type == sasi::ParticleType::Void)
+    const sasi::CellCursor cell = simulator->getCursor(x, y);
+
+    // If the cell below is free, move into it, or as far past it as the particle's speed
+    // allows when it has a velocity.
+    const bool hasVelocity = simulator->getVelocityOptions().enabled;
+    const sasi::ParticleType below = cell.getType(0, 1);
+    if (below == sasi::ParticleType::Void)
     {
-        simulator->move(x, y, x, y + 1, simulator->make(sasi::ParticleType::Void));
+        if (hasVelocity)
+        {
+            velocityFall(simulator, cell);
+            return;
+        }
+
+        cell.move(0, 1, simulator->make(sasi::ParticleType::Void));
         return;
     }
 
-    // If the below type is a liquid we can move through, swap us.
-    if (below.type == sasi::ParticleType::Water)
+    if (hasVelocity)
     {
-       simulator->swap(x, y, x, y + 1);
+        velocityLand(cell);
     }
 
-    // If the cell below-left is free, move into it.
-    const sasi::Particle& belowLeft = simulator->getParticle(x - 1, y + 1);
-    if (belowLeft.type == sasi::ParticleType::Void)
+    // If the below type is a liquid we can move through, swap us.
+    if (below == sasi::ParticleType::Water)
     {
-        simulator->move(x, y, x - 1, y + 1, simulator->make(sasi::ParticleType::Void));
-        return;
+       cell.swap(0, 1);
     }
 
-    // If the cell below-right is free, move into it.
-    const sasi::Particle& belowRight = simulator->getParticle(x + 1, y + 1);
-    if (belowRight.type == sasi::ParticleType::Void)
+    // Try the diagonals in a random order each step, so piles do not lean to one side.
+    const int first = ((simulator->getCellRandom(x, y) & 1u) != 0u) ? 1 : -1;
+    for (const int dx : { first, -first })
     {
-        simulator->move(x, y, x + 1, y + 1, simulator->make(sasi::ParticleType::Void));
-        return;
+        if (cell.getType(dx, 1) == sasi::ParticleType::Void)
+        {
+            cell.move(dx, 1, simulator->make(sasi::ParticleType::Void));
+            return;
+        }
     }
 }
+
+template <>
+struct sasi::ParticleKernel<sasi::ParticleType::Sand>
+{
+    static constexpr sasi::TickFunction tick = sandTick;
+    static constexpr sasi::MakeFunction make = sandMake;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+
+#include "particle.h"
+#include "particle_simulator.h"
+
+// Helpers for the built-in kernels while velocities are enabled.
+
+// Falls into the void below the cell, gaining speed, and crosses as many void cells along the
+// particle's velocity as its speed allows. Sideways speed carries over, so particles leaving a
+// ledge arc off it. Only call when the cell below is void.
+inline void velocityFall(sasi::ParticleSimulator* simulator, const sasi::CellCursor& cell)
+{
+    const float maxSpeed = static_cast<float>(sasi::ParticleSimulator::k_walkReach);
+    sasi::Velocity velocity = cell.getVelocity();
+    velocity.y = std::min(std::max(velocity.y, 0.0f) + simulator->getVelocityOptions().gravity, maxSpeed);
+
+    // A walk that ends up going nowhere or only sideways drops the sideways speed and takes the
+    // void below instead.
+    int dx = 0;
+    int dy = 0;
+    if ((cell.walk(static_cast<int>(velocity.x), std::max(static_cast<int>(velocity.y), 1), dx, dy) == 0) || (dy == 0))
+    {
+        velocity.x = 0.0f;
+        dx = 0;
+        dy = 1;
+    }
+
+    cell.setVelocity(velocity);
+    cell.move(dx, dy, simulator->make(sasi::ParticleType::Void));
+}
+
+// Stops the particle falling once something is below it. Sideways speed is kept.
+inline void velocityLand(const sasi::CellCursor& cell)
+{
+    sasi::Velocity velocity = cell.getVelocity();
+    if (velocity.y != 0.0f)
+    {
+        velocity.y = 0.0f;
+        cell.setVelocity(velocity);
+    }
+}
+
+// Spreads sideways by up to the dispersion rate in one move. A particle already spreading
+// keeps going the same way until blocked, a resting one starts towards firstSide. Returns
+// false and comes to rest if both sides are blocked.
+inline bool velocitySpread(sasi::ParticleSimulator* simulator, const sasi::CellCursor& cell, int firstSide)
+{
+    const float dispersion = simulator->getVelocityOptions().dispersion;
+    const sasi::Velocity velocity = cell.getVelocity();
+    const int side = (velocity.x > 0.0f) ? 1 : ((velocity.x < 0.0f) ? -1 : firstSide);
+    const int distance = std::max(static_cast<int>(dispersion), 1);
+    for (const int dx : { side, -side })
+    {
+        int walkDx = 0;
+        int walkDy = 0;
+        if (cell.walk(dx * distance, 0, walkDx, walkDy) > 0)
+        {
+            cell.setVelocity(sasi::Velocity{ static_cast<float>(dx) * dispersion, 0.0f });
+            cell.move(walkDx, walkDy, simulator->make(sasi::ParticleType::Void));
+            return true;
+        }
+    }
+
+    if (velocity.x != 0.0f)
+    {
+        cell.setVelocity(sasi::Velocity{});
+    }
+    return false;
+}
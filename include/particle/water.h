@@ -1,52 +1,74 @@
 #pragma once
 
 #include "particle.h"
+#include "particle_registry.h"
 #include "particle_simulator.h"
 
-sasi::Particle waterMake(const sasi::ParticleSimulator* simulator)
+#include "particle/velocity.h"
+
+inline sasi::Particle waterMake(const sasi::ParticleSimulator* simulator)
 {
     return sasi::Particle{ sasi::ParticleType::Water, 0xFFFF0000 };
 }
 
-void waterTick(sasi::ParticleSimulator* simulator, sasi::Particle& particle, int x, int y)
+inline void waterTick(sasi::ParticleSimulator* simulator, int x, int y)
 {
-    // If the cell below is free, move into it.
-    const sasi::Particle& below = simulator->getParticle(x, y + 1);
-    if (below.type == sasi::ParticleType::Void)
+    const sasi::CellCursor cell = simulator->getCursor(x, y);
+
+    // If the cell below is free, move into it, or as far past it as the particle's speed
+    // allows when it has a velocity.
+    const bool hasVelocity = simulator->getVelocityOptions().enabled;
+    const sasi::ParticleType below = cell.getType(0, 1);
+    if (below == sasi::ParticleType::Void)
     {
-        simulator->move(x, y, x, y + 1, simulator->make(sasi::ParticleType::Void));
+        if (hasVelocity)
+        {
+            velocityFall(simulator, cell);
+            return;
+        }
+
+        cell.move(0, 1, simulator->make(sasi::ParticleType::Void));
         return;
     }
 
-    // If the cell below-left is free, move into it.
-    const sasi::Particle& belowLeft = simulator->getParticle(x - 1, y + 1);
-    if (belowLeft.type == sasi::ParticleType::Void)
+    if (hasVelocity)
     {
-        simulator->move(x, y, x - 1, y + 1, simulator->make(sasi::ParticleType::Void));
-        return;
+        velocityLand(cell);
     }
 
-    // If the cell below-right is free, move into it.
-    const sasi::Particle& belowRight = simulator->getParticle(x + 1, y + 1);
-    if (belowRight.type == sasi::ParticleType::Void)
+    // Try both diagonals, then both sides, each pair in a random order each step, so water
+    // levels out instead of drifting left. Each pair takes its own bit of the cell's value.
+    const uint32_t random = simulator->getCellRandom(x, y);
+    const int firstDiagonal = ((random & 1u) != 0u) ? 1 : -1;
+    for (const int dx : { firstDiagonal, -firstDiagonal })
     {
-        simulator->move(x, y, x + 1, y + 1, simulator->make(sasi::ParticleType::Void));
-        return;
+        if (cell.getType(dx, 1) == sasi::ParticleType::Void)
+        {
+            cell.move(dx, 1, simulator->make(sasi::ParticleType::Void));
+            return;
+        }
     }
 
-    // If the cell left is free spread.
-    const sasi::Particle& left = simulator->getParticle(x - 1, y);
-    if (left.type == sasi::ParticleType::Void)
+    const int firstSide = ((random & 2u) != 0u) ? 1 : -1;
+    if (hasVelocity)
     {
-        simulator->move(x, y, x - 1, y, simulator->make(sasi::ParticleType::Void));
+        velocitySpread(simulator, cell, firstSide);
         return;
     }
 
-    // If the cell right is free spread.
-    const sasi::Particle& right = simulator->getParticle(x + 1, y);
-    if (right.type == sasi::ParticleType::Void)
+    for (const int dx : { firstSide, -firstSide })
     {
-        simulator->move(x, y, x + 1, y, simulator->make(sasi::ParticleType::Void));
-        return;
+        if (cell.getType(dx, 0) == sasi::ParticleType::Void)
+        {
+            cell.move(dx, 0, simulator->make(sasi::ParticleType::Void));
+            return;
+        }
     }
 }
+
+template <>
+struct sasi::ParticleKernel<sasi::ParticleType::Water>
+{
+    static constexpr sasi::TickFunction tick = waterTick;
+    static constexpr sasi::MakeFunction make = waterMake;
+};
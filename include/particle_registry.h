@@ -1,26 +1,78 @@
 #pragma once
 
-#include <unordered_map>
+#include <array>
+#include <cstdint>
 
+#include "material_rules.h"
 #include "particle.h"
 
 namespace sasi
 {
     class ParticleSimulator;
 
-    typedef void (*TickFunction)(ParticleSimulator* simulator, Particle& particle, int x, int y);
+    // Invoked once per step for every awake particle of a registered type. Tick functions must
+    // stay within ParticleSimulator::k_tickReach cells of (x, y) for everything they read or
+    // write, since neighbouring chunks may be ticking on other threads. Only a walk from the
+    // cell cursor may go further, to the end of the walk.
+    typedef void (*TickFunction)(ParticleSimulator* simulator, int x, int y);
     typedef Particle (*MakeFunction)(const ParticleSimulator* simulator);
 
+    // Compile-time kernels for the built-in particle types. Each built-in particle header
+    // specialises this with static tick and make functions, which lets the simulator call them
+    // directly from its type switch instead of through a function pointer.
+    template <ParticleType Type>
+    struct ParticleKernel;
+
     class ParticleRegistry
     {
     public:
+        static constexpr int k_maxParticleTypes = static_cast<int>(ParticleType::Max) + 1;
+
+        // First type id handed out to particles registered at runtime.
+        static constexpr ParticleType k_firstCustomType = static_cast<ParticleType>(static_cast<uint8_t>(ParticleType::Water) + 1);
+
         ParticleRegistry();
 
-        TickFunction getTickFunction(ParticleType type) const;
-        MakeFunction getMakeFunction(ParticleType type) const;
+        inline TickFunction getTickFunction(ParticleType type) const
+        {
+            return m_tickFunctions[static_cast<uint8_t>(type)];
+        }
+
+        inline MakeFunction getMakeFunction(ParticleType type) const
+        {
+            return m_makeFunctions[static_cast<uint8_t>(type)];
+        }
+
+        // Registers a new particle type at runtime and returns its id. Returns ParticleType::Max
+        // when every id is taken.
+        ParticleType registerParticle(TickFunction tickFunction, MakeFunction makeFunction);
+
+        // Registers a material loaded from a definition file and returns its id. Materials are
+        // ticked by the generic rule kernel instead of a tick function. Returns ParticleType::Max
+        // when every id is taken or the definition does not fit the rule tables.
+        ParticleType registerMaterial(const MaterialDefinition& definition);
+
+        inline const MaterialTable& getMaterials() const
+        {
+            return m_materials;
+        }
+
+        bool isRegistered(ParticleType type) const;
 
     private:
-        std::unordered_map<ParticleType, TickFunction> m_tickFunctions;
-        std::unordered_map<ParticleType, MakeFunction> m_makeFunctions;
+        template <ParticleType Type>
+        void registerBuiltIn()
+        {
+            m_tickFunctions[static_cast<uint8_t>(Type)] = ParticleKernel<Type>::tick;
+            m_makeFunctions[static_cast<uint8_t>(Type)] = ParticleKernel<Type>::make;
+        }
+
+    private:
+        // Dense tables indexed directly by type.
+        std::array<TickFunction, k_maxParticleTypes> m_tickFunctions;
+        std::array<MakeFunction, k_maxParticleTypes> m_makeFunctions;
+        MaterialTable m_materials;
+
+        int m_nextCustomType;
     };
-}
\ No newline at end of file
+}
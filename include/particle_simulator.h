@@ -1,33 +1,240 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdlib>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
-#include "sasi.h"
+#include "sasi_core.h"
 
+#include "cell_random.h"
+#include "dirty_rect.h"
+#include "metrics.h"
 #include "particle.h"
 #include "particle_registry.h"
 
 namespace sasi
 {
+    // A fixed-size square region of the grid. Chunks whose dirty rects are empty are asleep and
+    // are skipped entirely by the tick.
+    struct Chunk
+    {
+        // Cells to simulate during the current step.
+        DirtyRect current;
+
+        // Cells touched during the current step (or between steps) that need simulating next step.
+        // Chunks ticked in parallel can wake the same neighbour, so this one is atomic.
+        AtomicDirtyRect next;
+
+        // Colour data changed since the dirty rects were last consumed.
+        DirtyRect colorChanged;
+
+        // Margolus backend only. Cells simulated last step, kept awake for one more: blocks that
+        // held still there may move once the grid is split into blocks the other way.
+        DirtyRect previous;
+
+        // Particles ticked in the chunk this step and how many of them left their cell. Only
+        // the thread ticking the chunk writes these.
+        uint32_t particlesTicked = 0u;
+        uint32_t particlesMoved = 0u;
+    };
+
+    enum class SimulationBackend
+    {
+        // Runs the tick function of every awake particle in scan order, or checkerboard order
+        // with several threads.
+        CellScan,
+
+        // A block cellular automaton on the Margolus neighbourhood. Every step splits the grid
+        // into 2x2 blocks, shifted by one cell on both axes every other step, and rewrites each
+        // block with one table lookup on its packed state. Blocks never overlap, so results do
+        // not depend on the order or the threads they are updated on. Only sand and water move,
+        // every other type stands still.
+        Margolus,
+    };
+
+    struct VelocityOptions
+    {
+        // Keeps a velocity for every cell in a side plane, so sand and water can cross several
+        // cells in one step instead of one. Only the cell scan backend uses it, and the row
+        // kernel is skipped while it is on since it moves particles without their velocity.
+        bool enabled = false;
+
+        // Cells per step added to the speed of a falling particle every step.
+        float gravity = 0.5f;
+
+        // Cells per step water spreads sideways once it has nowhere to fall.
+        float dispersion = 4.0f;
+    };
+
+    struct SimulatorOptions
+    {
+        // Number of threads used to tick the grid. One keeps the single-threaded row-major scan,
+        // more switches to the checkerboard chunk update.
+        int threadCount = 1;
+
+        // Moves uncontested straight falls of built-in particles a whole chunk row at a time
+        // with vector instructions. Gives the same results as the per-cell tick.
+        bool useRowKernels = true;
+
+        SimulationBackend backend = SimulationBackend::CellScan;
+
+        // Seeds the random values tick functions draw, see getRandom. Runs with the same seed
+        // and the same edits repeat exactly.
+        uint32_t randomSeed = 0u;
+
+        VelocityOptions velocity;
+    };
+
+    class ThreadPool;
+    class ParticleSimulator;
+
+    // A particle's cell as seen by its tick function, reading and writing neighbours by offset.
+    // The grid is ringed by k_tickReach cells of OutOfBounds, so any offset within the tick
+    // reach lands on a real cell and needs no bounds check. Moves and swaps must target cells
+    // inside the grid, which holds for any target a tick function found to be void or another
+    // particle. The cursor stays on the cell it was made for.
+    class CellCursor
+    {
+    public:
+        CellCursor(ParticleSimulator* simulator, int x, int y);
+
+        int getX() const;
+        int getY() const;
+
+        ParticleType getType(int dx, int dy) const;
+        Particle getParticle(int dx, int dy) const;
+
+        // Unchecked counterparts of ParticleSimulator::move and swap.
+        void move(int dx, int dy, const Particle& replace) const;
+        void swap(int dx, int dy) const;
+
+        // The velocity of the cell's particle, which moves and swaps carry along. Only valid
+        // while velocities are enabled.
+        Velocity getVelocity() const;
+        void setVelocity(const Velocity& velocity) const;
+
+        // Follows the line from the cell towards the offset (dx, dy) through void cells, for at
+        // most k_walkReach cells. Returns how many cells were crossed and the offset of the last
+        // one, where a move can take the particle. Each cell probed neighbours one already
+        // found void, so walks stop at the ghost border like any other probe.
+        int walk(int dx, int dy, int& outDx, int& outDy) const;
+
+    private:
+        ParticleSimulator* m_simulator;
+        int m_x;
+        int m_y;
+        int m_index;
+    };
+
     class ParticleSimulator
     {
     public:
-        ParticleSimulator(int width, int height);
-    
+        static constexpr int k_chunkSize = 32;
+        static_assert(k_chunkSize == 32, "Updated masks store one chunk row per 32-bit word.");
+
+        // Tick functions may only read and write cells within this many cells of the particle
+        // they were invoked for. The checkerboard update relies on it: chunks updated at the same
+        // time are a whole chunk apart, so neither can reach into cells the other touches.
+        static constexpr int k_tickReach = 1;
+        static_assert(k_tickReach * 2 <= k_chunkSize, "Tick reach must not span half a chunk.");
+
+        // Width of the OutOfBounds border around the cell planes, enough for any neighbour a
+        // tick function may probe.
+        static constexpr int k_ghostCells = k_tickReach;
+
+        // The one exception to the tick reach: a particle may walk this many cells in a single
+        // move, see CellCursor::walk. Walks from chunks updated at the same time, and the cell
+        // each probes past its end, still cannot meet in the chunk between them.
+        static constexpr int k_walkReach = (k_chunkSize / 2) - k_tickReach;
+        static_assert((k_walkReach + k_tickReach) * 2 <= k_chunkSize, "Walks must not span half a chunk.");
+
+        ParticleSimulator(int width, int height, const SimulatorOptions& options = SimulatorOptions{});
+        ~ParticleSimulator();
+
         // Move particle registration to a new class `ParticleRegistry`
         // This is forward declared which stops any circular include
 
         void tick(double fixedDeltaTime);
 
+        // Timings and counts gathered by the most recent tick.
+        const StepMetrics& getLastStepMetrics() const;
+
+        // Steps ticked so far. Random choices and the Margolus partition are keyed on it, so a
+        // world loaded from a snapshot has to carry on from the step it was saved at to play
+        // out as it would have. Must not be set during a step.
+        uint64_t getStep() const;
+        void setStep(uint64_t step);
+
+        // The options the simulator runs with, after dropping any its backend cannot use.
+        SimulatorOptions getOptions() const;
+
         size_t getColorDataSize() const;
         int getColorDataWidth() const;
         int getColorDataHeight() const;
         const uint32_t* getColorData() const;
 
+        // The type plane, one byte per cell starting at the top left cell, with rows
+        // getPlaneStride() cells apart. Together with a palette from buildPalette this is
+        // enough to render the world without colour data.
+        const ParticleType* getTypeData() const;
+
+        // Cells from the start of one row to the next in the type plane and cell colours, which
+        // are wider than the grid by the ghost border on each side.
+        int getPlaneStride() const;
+
+        // Stops or resumes copying particle colours into the colour data at the end of each
+        // step. Renderers working from the type plane can switch it off. Switching it back on
+        // refreshes the whole colour data and reports all of it as changed.
+        void setColorOutputEnabled(bool enabled);
+        bool isColorOutputEnabled() const;
+
+        // The colour plane ticks write to, laid out like the type plane. Unlike the colour data
+        // it is always current, but it changes during a step.
+        const uint32_t* getCellColors() const;
+
+        // Replaces every cell with the planes given, laid out like the colour data, and wakes
+        // the whole grid. Must not be called during a step.
+        void loadCells(const ParticleType* types, const uint32_t* colors);
+
+        // Copies the cells of one chunk out of the grid or into it, k_chunkSize rows of
+        // k_chunkSize cells each. The chunk must lie wholly inside the grid. Writing wakes the
+        // chunk and its neighbours. Must not be called during a step.
+        void readChunkCells(int chunkX, int chunkY, ParticleType* outTypes, uint32_t* outColors) const;
+        void writeChunkCells(int chunkX, int chunkY, const ParticleType* types, const uint32_t* colors);
+
+        // Slides the grid over the world by (cellsX, cellsY), so the cell that was at
+        // (x + cellsX, y + cellsY) ends up at (x, y). Cells uncovered at the far edges are
+        // emptied and the world origin moves by the same amount. Wakes the whole grid. Must not
+        // be called during a step.
+        void scrollWorld(int cellsX, int cellsY);
+
+        // World cell that the grid's top left cell stands for. Zero unless the grid has been
+        // scrolled or set.
+        int getWorldOriginX() const;
+        int getWorldOriginY() const;
+
+        // Moves the grid over the world without moving any cell, for loading cells saved at
+        // another origin. Random choices are keyed on world cells, so a loaded world only plays
+        // out as it would have at the origin it was saved at. Must not be called during a step.
+        void setWorldOrigin(int originX, int originY);
+
+        // Writes the colour of every particle type into a table of
+        // ParticleRegistry::k_maxParticleTypes entries. Unregistered types are transparent.
+        void buildPalette(uint32_t* outPalette) const;
+
+        // Appends the regions of cells that changed since the last call, merged into as few
+        // rects as is practical, and starts collecting afresh. They cover changes to both the
+        // type plane and the colour data. Nothing is appended when no cell changed.
+        void consumeDirtyRects(std::vector<DirtyRect>& outRects);
+
         bool isValidCoord(int x, int y) const;
         bool isValidIndex(int index) const;
 
+        // Indices count cells row by row across the grid, like the colour data, and are
+        // unrelated to where cells sit in the padded planes.
         int indexToX(int index) const;
         int indexToY(int index) const;
         int coordToIndex(int x, int y) const;
@@ -35,39 +242,305 @@ namespace sasi
         void setParticle(int index, const Particle& particle);
         void setParticle(int x, int y, const Particle& particle);
 
-        const Particle& getParticle(int index) const;
-        const Particle& getParticle(int x, int y) const;
+        // Assembles a view of the cell. Out-of-bounds cells read as an OutOfBounds particle.
+        Particle getParticle(int index) const;
+        Particle getParticle(int x, int y) const;
+
+        // Reads only the type plane. Preferred by tick functions, which rarely need more.
+        ParticleType getType(int index) const;
+        ParticleType getType(int x, int y) const;
+
+        // Creates a particle at the world location given, offset by the world origin. If the world
+        // location corresponds to a cell outside the grid the particle will not be created.
+        void makeParticleAtWorldLocation(ParticleType type, float worldX, float worldY);
 
-        // Creates a particle at the world location given. If the world location corresponds to an
-        // a cell that is outside the bounds of a simulation the particle will not be created.
-        void makeParticleAtWorldLocation(ParticleType type, const bx::Vec3& worldLocation);
+        // Finds the grid cell holding a world location, which may lie outside the grid.
+        void worldToCell(float worldX, float worldY, int& outX, int& outY) const;
+
+        // Bulk edits for brushes. Each one makes a single particle of the type, writes it into
+        // whole spans of cells and wakes their bounds once, so large brushes cost little more
+        // than the cells they cover. Density is the fraction of covered cells written, chosen
+        // by hashing the seed with each cell's world coord so replays pick the same cells.
+        // Shapes are clipped to the grid. Must not be called during a step.
+        void fillRect(int minX, int minY, int maxX, int maxY, ParticleType type, float density = 1.0f, uint32_t seed = 0u);
+        void fillCircle(int centerX, int centerY, int radius, ParticleType type, float density = 1.0f, uint32_t seed = 0u);
+
+        // Fills every cell within radius of the line between two cells, so a brush dragged
+        // between two frames leaves no gaps.
+        void fillLine(int fromX, int fromY, int toX, int toY, int radius, ParticleType type, float density = 1.0f, uint32_t seed = 0u);
 
         // Moves the particle at (fromX, fromY) to (toX, toY) without changing
         // any properties. Original position is filled based on particle passed
         // via replace param.
         void move(int fromX, int fromY, int toX, int toY, const Particle& replace);
 
+        // Makes a cursor for tick functions over the cell at a valid coord.
+        CellCursor getCursor(int x, int y);
+
         // Invokes the registered make function for a type of particle to create a particle
         // of that type. If no make function was registered, a void particle is returned.
         Particle make(ParticleType type) const;
 
+        // Registers a particle type at runtime, see ParticleRegistry::registerParticle. Built-in
+        // types keep their compile-time kernels.
+        ParticleType registerParticle(TickFunction tickFunction, MakeFunction makeFunction);
+
+        // Registers a material from a definition file, see ParticleRegistry::registerMaterial.
+        // Must not be called during a step.
+        ParticleType registerMaterial(const MaterialDefinition& definition);
+        const MaterialTable& getMaterials() const;
+
+        // A random value for the cell at (x, y) that changes every step. It depends only on the
+        // seed, the step and the cell's world coord, so runs repeat it whatever order or thread
+        // cells tick on.
+        uint32_t getCellRandom(int x, int y) const;
+
+        // This step's random values by world coord, for tick functions drawing a row at a time.
+        const CellRandom& getRandom() const;
+
+        // Velocity settings the simulator was made with. Velocities are off for backends that
+        // do not use them.
+        const VelocityOptions& getVelocityOptions() const;
+
         // Swaps the particle at (fromX, fromY) with the particle at (toX, toY)
         // without changing any properties. The swap only takes place if both
         // provided particle coordinates are valid.
         void swap(int fromX, int fromY, int toX, int toY);
 
+        int getChunkCountX() const;
+        int getChunkCountY() const;
+        const Chunk& getChunk(int chunkX, int chunkY) const;
+
+    private:
+        friend class CellCursor;
+
+        // Position of a valid coord in the padded planes.
+        int cellIndex(int x, int y) const;
+
+        // move and swap without the bounds checks. Coords must be valid.
+        void moveUnchecked(int fromX, int fromY, int toX, int toY, const Particle& replace);
+        void swapUnchecked(int fromX, int fromY, int toX, int toY);
+
+        // Runs the tick function of the particle at (x, y) unless it was already updated this
+        // step. The row word is the updated mask row holding the cell, and the chunk is the one
+        // holding it, whose counters are bumped.
+        void tickParticle(int x, int y, uint32_t& updatedRow, Chunk& chunk);
+
+        // Ticks the cells of one chunk row that lie inside the chunk's current rect, batching
+        // uncontested falls through the row kernel when enabled.
+        void tickChunkRow(int chunkX, int y, Chunk& chunk, uint32_t& updatedRow);
+
+        // Moves every particle flagged in falls down one cell. Bit i stands for chunkMinX + i.
+        void applyFalls(int chunkMinX, int y, uint32_t falls);
+
+        // Single-threaded update visiting awake cells in row-major order.
+        void tickRows();
+
+        // Parallel update visiting awake chunks in four checkerboard phases.
+        void tickCheckerboard();
+
+        // Margolus update of every awake chunk, in parallel when there is a pool.
+        void tickMargolus();
+
+        // Rewrites the blocks whose top left cell lies in the chunk and near its current rect.
+        // Blocks are offset by one cell on odd steps.
+        void tickMargolusChunk(int chunkIndex, int offset);
+
+        // Writes the particle into the grid and wakes the cells around it. Coord must be valid.
+        void writeParticle(int x, int y, const Particle& particle);
+
+        // Copies every plane of one cell, including its updated bit, into another. Coords must
+        // be valid.
+        void copyCell(int fromX, int fromY, int toX, int toY);
+
+        uint32_t& updatedWord(int x, int y) const;
+        bool isUpdated(int x, int y) const;
+        void setUpdated(int x, int y, bool updated);
+
+        // Sets the bits of word selected by bits to the matching bits of values.
+        void writeUpdatedBits(uint32_t& word, uint32_t bits, uint32_t values);
+
+        // Reports every cell as changed, and with wake set simulates all of them next step.
+        void markAllChanged(bool wake);
+
+        // Expands the next-step dirty rects of every chunk overlapping the changed cells plus a
+        // one cell border, so neighbours across chunk borders are woken too.
+        void markDirty(int changedMinX, int changedMinY, int changedMaxX, int changedMaxY);
+
+        // Copies particle colours into the colour data for the cells inside the rect.
+        void copyColors(const DirtyRect& rect);
+
+        // Copies every particle colour into the colour data.
+        void copyAllColors();
+
+        // Resets the brush spans to cover no cells in rows minY to maxY, clipped to the grid.
+        void beginBrushSpans(int minY, int maxY);
+
+        // Widens the brush span of row y to cover minX to maxX. Rows outside the spans begun
+        // are ignored.
+        void addBrushSpan(int y, int minX, int maxX);
+
+        // Writes a particle of the type into the cells of the brush spans.
+        void fillBrushSpans(ParticleType type, float density, uint32_t seed);
+
+    private:
+        // One bit per cell of a chunk, set once the particle in that cell has been updated this
+        // step. Bits travel with particles as they move so nothing is updated twice. The whole
+        // mask is cleared with a few vector stores once the step is over.
+        struct alignas(32) UpdatedMask
+        {
+            uint32_t rows[k_chunkSize];
+        };
+
+        void clearUpdatedMask(int chunkIndex);
+
     private:
         int m_width;
         int m_height;
         int m_dataSize;
 
+        // Row length and total size of the padded planes.
+        int m_stride;
+        int m_planeSize;
+
+        int m_worldOriginX;
+        int m_worldOriginY;
+
+        int m_chunkCountX;
+        int m_chunkCountY;
+        std::unique_ptr<Chunk[]> m_chunks;
+
+        // Scratch list of awake chunk columns for the chunk row being ticked.
+        std::unique_ptr<int[]> m_awakeChunkColumns;
+
+        // Scratch list of awake chunk indices for the checkerboard phase being ticked.
+        std::vector<int> m_phaseChunks;
+
+        // Scratch list used while consuming dirty rects.
+        std::vector<DirtyRect> m_dirtyRectScratch;
+
+        // Cells covered by the brush edit being made, a min and max x for each row from
+        // m_brushMinY on. Rows with min above max are empty.
+        std::vector<int> m_brushSpans;
+        int m_brushMinY;
+
+        std::unique_ptr<ThreadPool> m_threadPool;
+        bool m_useRowKernels;
+        SimulationBackend m_backend;
+
+        // Margolus backend tables. Each type maps to a 2-bit class, four of which make a block's
+        // state, and each state maps to the cell of the block each of its cells is taken from,
+        // 2 bits apiece. See buildBlockRules.
+        std::array<uint8_t, ParticleRegistry::k_maxParticleTypes> m_blockClasses;
+        std::array<uint8_t, 256> m_blockRules;
+        bool m_isColorOutputEnabled;
+
         uint64_t m_simulationStep;
+        uint32_t m_randomSeed;
+        CellRandom m_random;
+        StepMetrics m_lastStepMetrics;
 
         std::unique_ptr<ParticleRegistry> m_particleRegistry;
-        std::unique_ptr<Particle[]> m_particleData;
+        // Cells are stored as a structure of arrays. The hot path mostly probes types, so keeping
+        // them in a packed plane of their own means neighbour checks only pull types through
+        // the cache. The type and colour planes are ringed by k_ghostCells of OutOfBounds, and
+        // the type plane has a chunk's worth of slack after that so row kernels can always load
+        // a full chunk row. The colour data is the grid alone.
+        std::unique_ptr<ParticleType[]> m_types;
+        std::unique_ptr<uint32_t[]> m_colors;
+        std::unique_ptr<UpdatedMask[]> m_updatedMasks;
         std::unique_ptr<uint32_t[]> m_colorData;
 
+        // Laid out like the type plane when velocities are enabled, null otherwise. Cells
+        // written from outside a tick, by edits, loads or streaming, start at rest.
+        VelocityOptions m_velocityOptions;
+        std::unique_ptr<Velocity[]> m_velocities;
+
         Particle m_particleOutOfBounds;
         Particle m_particleVoid;
     };
-}
\ No newline at end of file
+}
+
+inline sasi::CellCursor::CellCursor(ParticleSimulator* simulator, int x, int y)
+    : m_simulator(simulator)
+    , m_x(x)
+    , m_y(y)
+    , m_index(simulator->cellIndex(x, y))
+{
+}
+
+inline int sasi::CellCursor::getX() const
+{
+    return m_x;
+}
+
+inline int sasi::CellCursor::getY() const
+{
+    return m_y;
+}
+
+inline sasi::ParticleType sasi::CellCursor::getType(int dx, int dy) const
+{
+    return m_simulator->m_types[m_index + (dy * m_simulator->m_stride) + dx];
+}
+
+inline sasi::Particle sasi::CellCursor::getParticle(int dx, int dy) const
+{
+    const int index = m_index + (dy * m_simulator->m_stride) + dx;
+    return Particle{ m_simulator->m_types[index], m_simulator->m_colors[index] };
+}
+
+inline void sasi::CellCursor::move(int dx, int dy, const Particle& replace) const
+{
+    m_simulator->moveUnchecked(m_x, m_y, m_x + dx, m_y + dy, replace);
+}
+
+inline void sasi::CellCursor::swap(int dx, int dy) const
+{
+    m_simulator->swapUnchecked(m_x, m_y, m_x + dx, m_y + dy);
+}
+
+inline sasi::Velocity sasi::CellCursor::getVelocity() const
+{
+    return m_simulator->m_velocities[m_index];
+}
+
+inline void sasi::CellCursor::setVelocity(const Velocity& velocity) const
+{
+    m_simulator->m_velocities[m_index] = velocity;
+}
+
+inline int sasi::CellCursor::walk(int dx, int dy, int& outDx, int& outDy) const
+{
+    outDx = 0;
+    outDy = 0;
+
+    // Steps along the longer axis, rounding the shorter one to the nearest cell.
+    const int length = std::max(std::abs(dx), std::abs(dy));
+    const int steps = std::min(length, ParticleSimulator::k_walkReach);
+    int walked = 0;
+    for (int step = 1; step <= steps; ++step)
+    {
+        const int cellDx = ((2 * dx * step) + ((dx < 0) ? -length : length)) / (2 * length);
+        const int cellDy = ((2 * dy * step) + ((dy < 0) ? -length : length)) / (2 * length);
+        if (getType(cellDx, cellDy) != ParticleType::Void)
+        {
+            break;
+        }
+
+        outDx = cellDx;
+        outDy = cellDy;
+        ++walked;
+    }
+    return walked;
+}
+
+inline sasi::CellCursor sasi::ParticleSimulator::getCursor(int x, int y)
+{
+    return CellCursor(this, x, y);
+}
+
+inline int sasi::ParticleSimulator::cellIndex(int x, int y) const
+{
+    return ((y + k_ghostCells) * m_stride) + x + k_ghostCells;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+#include "particle.h"
+
+namespace sasi
+{
+    // Bit masks describing 32 consecutive cells of a row, bit i standing for cell i.
+    struct RowMasks
+    {
+        // Cells holding a particle with a tick function worth running (not Void or OutOfBounds).
+        uint32_t active;
+
+        // Cells holding a built-in particle that falls straight down into Void (Sand or Water).
+        uint32_t fallers;
+
+        // Cells whose neighbour directly below is Void.
+        uint32_t belowVoid;
+    };
+
+    // Classifies 32 cells starting at row against the 32 cells starting at below. Both pointers
+    // must have 32 readable bytes. Pass nullptr for below on the bottom row.
+    RowMasks classifyRow(const ParticleType* row, const ParticleType* below);
+
+    // Returns the cells of fallers that can fall straight down without changing the outcome of
+    // the left-to-right scan, given the cells that will be ticked. A faller is contested when
+    // the cell to its left may still move diagonally into the space below it, which is the case
+    // for any ticked non-faller and for any contested faller.
+    inline uint32_t findUncontestedFalls(uint32_t ticked, uint32_t fallers)
+    {
+        const uint32_t others = ticked & ~fallers;
+
+        // Spread each other cell's influence rightwards through the run of ticked cells after
+        // it, in log2(32) shift steps.
+        uint32_t contested = (others << 1) & ticked;
+        uint32_t run = ticked;
+        contested |= run & (contested << 1);
+        run &= run << 1;
+        contested |= run & (contested << 2);
+        run &= run << 2;
+        contested |= run & (contested << 4);
+        run &= run << 4;
+        contested |= run & (contested << 8);
+        run &= run << 8;
+        contested |= run & (contested << 16);
+
+        return fallers & ~contested;
+    }
+}
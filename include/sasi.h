@@ -4,7 +4,4 @@
 
 #include <bx/math.h>
 
-namespace sasi
-{
-    const static float k_pixelsPerUnit = 8.0f;
-}
\ No newline at end of file
+#include "sasi_core.h"
@@ -0,0 +1,8 @@
+#pragma once
+
+// Constants shared by the simulation core. Nothing in here may depend on a graphics library so
+// the core can be built headless.
+namespace sasi
+{
+    const static float k_pixelsPerUnit = 8.0f;
+}
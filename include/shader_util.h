@@ -4,13 +4,15 @@
 
 #include <bgfx/bgfx.h>
 
+#include "log.h"
+
 bool loadShader(bgfx::ShaderHandle& outShaderHandle, std::string name)
 {
     std::ifstream stream;
     stream.open(name);
     if (!stream)
     {
-        std::cout << "Failed to open file " << name << "\n";
+        SASI_LOG_ERROR("Failed to open file %s", name.c_str());
         return false;
     }
 
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chunk_streamer.h"
+#include "dirty_rect.h"
+#include "fixed_step_scheduler.h"
+#include "input_recording.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include "particle.h"
+
+namespace sasi
+{
+    class ParticleSimulator;
+
+    // Work handed to the simulation thread, run against the simulator between two steps.
+    using SimulationCommand = std::function<void(ParticleSimulator&)>;
+
+    // A copy of the simulator's output that can be read while later steps run.
+    struct SimulationFrame
+    {
+        std::unique_ptr<uint32_t[]> colorData;
+        std::unique_ptr<ParticleType[]> typeData;
+
+        // Regions that changed since the frame acquired before this one. They may cover some
+        // unchanged cells too.
+        std::vector<DirtyRect> dirtyRects;
+
+        // Simulator step the frame was taken at.
+        uint64_t step;
+
+        // How the scheduler was keeping up when the frame was taken.
+        SchedulerStats schedulerStats;
+
+        // Percentiles over the most recent steps when the frame was taken.
+        MetricsSummary metrics;
+
+        // World cell shown by the top left cell of the planes, and how streaming was doing.
+        int worldOriginX;
+        int worldOriginY;
+        StreamingStats streamingStats;
+
+        // Increases by one with every frame published.
+        uint64_t serial;
+    };
+
+    // Runs a simulator's fixed steps on a thread of its own, paced by a FixedStepScheduler so
+    // that no update runs long after a stall. Finished frames are handed over through a triple
+    // buffer swapped with a single atomic exchange, so neither the simulation thread nor the
+    // reader ever waits on the other. The simulator must not be used directly while the thread
+    // runs, changes go through enqueue instead.
+    class SimulationThread
+    {
+    public:
+        SimulationThread(ParticleSimulator& simulator, const SchedulerOptions& schedulerOptions);
+        ~SimulationThread();
+
+        SimulationThread(const SimulationThread&) = delete;
+        SimulationThread& operator=(const SimulationThread&) = delete;
+
+        // Waits for the command or step in progress and ends the thread. Commands still queued
+        // never run, so owners whose members they capture stop the thread before those members
+        // go. Safe to call more than once, the destructor calls it too.
+        void stop();
+
+        // Queues a command to run on the simulation thread before its next step.
+        void enqueue(SimulationCommand command);
+
+        // Queues an edit to apply before the next step. Events are recorded when a recording
+        // is running and ignored while a replay is.
+        void enqueueInput(const InputEvent& event);
+
+        // Starts streaming the metrics of every step to a CSV file, written from the
+        // simulation thread.
+        void openMetricsCsv(const std::string& path);
+
+        // Starts recording the input events applied from the next step on, along with the
+        // simulator's settings and step. The world they are applied to is saved next to the
+        // recording, see getRecordingStartPath.
+        void startRecording(const std::string& path);
+
+        // Captures the world between two steps and writes it from a background thread, so the
+        // simulation only pauses for the copy.
+        void saveSnapshot(const std::string& path, SnapshotEncoding encoding);
+
+        // Replaces the world with a snapshot before the next step, ending any recording or
+        // replay made on the world it replaces. Refused while streaming, whose page file holds
+        // the world around the region rather than the one the snapshot was cut from.
+        void loadSnapshot(const std::string& path);
+
+        // Loads a recording and replays its events on the world and from the step the
+        // recording started at, counting steps from the next one. Returns false if the
+        // recording could not be loaded or was made on a grid of another size. Recordings made
+        // with other simulator settings are refused once the simulation thread gets to them.
+        bool startReplay(const std::string& path);
+
+        // Turns the grid into a window over an unbounded world that follows the streaming focus,
+        // see ChunkStreamer.
+        void enableStreaming(const StreamingOptions& options);
+
+        // Moves the point the streamed region follows, in world cells. Picked up before the
+        // next step.
+        void setStreamingFocus(float cellX, float cellY);
+
+        // Takes the latest published frame, if it is one the caller has not seen, and reports
+        // whether it did. The returned frame is left alone by the simulation thread until the
+        // next call. Must always be called from the same thread.
+        const SimulationFrame& acquireFrame(bool& outIsNew);
+
+    private:
+        void threadLoop();
+        void runCommands();
+        void applyInputs();
+        void updateStreaming();
+        void publishFrame();
+        void copyRect(SimulationFrame& frame, const DirtyRect& rect) const;
+
+    private:
+        static constexpr int k_frameCount = 3;
+
+        // Set alongside the index of the shared frame while it has not been acquired.
+        static constexpr uint32_t k_freshFrameBit = 1u << 31;
+
+        ParticleSimulator& m_simulator;
+        FixedStepScheduler m_scheduler;
+        MetricsRecorder m_metrics;
+        SnapshotWriter m_snapshotWriter;
+
+        // Input recording and replay, each counting steps from the one they started at.
+        InputRecorder m_recorder;
+        uint64_t m_recordingStartStep;
+        std::chrono::steady_clock::time_point m_recordingStartTime;
+        std::shared_ptr<InputReplay> m_replay;
+        uint64_t m_replayStartStep;
+
+        std::unique_ptr<ChunkStreamer> m_streamer;
+
+        SimulationFrame m_frames[k_frameCount];
+
+        // Regions in which each frame is older than the simulator, and the changes made since
+        // the frame the reader last acquired. Only the simulation thread touches these.
+        std::vector<DirtyRect> m_staleRects[k_frameCount];
+        std::vector<DirtyRect> m_unreadRects;
+        std::vector<DirtyRect> m_stepRects;
+
+        // The simulation thread writes the back frame and the reader reads the front frame.
+        // The frame between them is swapped in and out through m_sharedFrame.
+        int m_backFrame;
+        int m_frontFrame;
+        std::atomic<uint32_t> m_sharedFrame;
+
+        std::atomic<uint64_t> m_acquiredSerial;
+        uint64_t m_publishedSerial;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::vector<SimulationCommand> m_commands;
+        std::vector<SimulationCommand> m_runningCommands;
+        std::vector<InputEvent> m_inputs;
+        std::vector<InputEvent> m_runningInputs;
+        float m_streamingFocusX;
+        float m_streamingFocusY;
+        bool m_hasStreamingFocus;
+        bool m_isQuitting;
+
+        std::thread m_thread;
+    };
+}
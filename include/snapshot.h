@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "particle.h"
+
+namespace sasi
+{
+    class ParticleSimulator;
+
+    enum class SnapshotEncoding : uint32_t
+    {
+        // The cell planes exactly as they sit in memory, each starting on a page boundary so a
+        // mapped file can be read in place.
+        Raw = 0,
+
+        // Each chunk's cells run-length encoded, behind a table of chunk offsets. Smaller for
+        // worlds with large uniform areas, but decoded on load.
+        ChunkRle = 1,
+    };
+
+    // Fixed header at the start of every snapshot file. Fields are in the byte order of the
+    // machine that wrote them, which byteOrderMark lets a reader check.
+    struct SnapshotHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrderMark;
+        uint32_t encoding;
+        uint32_t width;
+        uint32_t height;
+        uint32_t chunkSize;
+        uint64_t step;
+
+        // World cell of the grid's top left cell, moved from zero by streaming.
+        int32_t worldOriginX;
+        int32_t worldOriginY;
+
+        // Where the type and colour planes live in the file. A ChunkRle snapshot keeps its
+        // whole payload in the type range and leaves the colour range empty.
+        uint64_t typeOffset;
+        uint64_t typeSize;
+        uint64_t colorOffset;
+        uint64_t colorSize;
+    };
+
+    // Copy of a world's cells taken between steps, ready to be written elsewhere.
+    struct SnapshotData
+    {
+        int width = 0;
+        int height = 0;
+        uint64_t step = 0ull;
+        int worldOriginX = 0;
+        int worldOriginY = 0;
+        std::vector<ParticleType> types;
+        std::vector<uint32_t> colors;
+    };
+
+    // Copies the simulator's cells, step and world origin. Cheap next to writing them, so it is the only part that
+    // has to happen between steps.
+    void captureSnapshot(const ParticleSimulator& simulator, SnapshotData& outData);
+
+    bool writeSnapshot(const std::string& path, const SnapshotData& data, SnapshotEncoding encoding);
+
+    // A snapshot file opened for reading. Raw snapshots are mapped and their planes point
+    // straight into the mapping, pages are only read as they are touched. ChunkRle snapshots
+    // are decoded into memory owned by the reader.
+    class MappedSnapshot
+    {
+    public:
+        MappedSnapshot();
+        ~MappedSnapshot();
+
+        MappedSnapshot(const MappedSnapshot&) = delete;
+        MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+        // Returns false, leaving the reader closed, if the file is missing or malformed.
+        bool open(const std::string& path);
+        void close();
+
+        int getWidth() const;
+        int getHeight() const;
+        uint64_t getStep() const;
+        int getWorldOriginX() const;
+        int getWorldOriginY() const;
+        SnapshotEncoding getEncoding() const;
+
+        // Cell planes laid out like the simulator's, valid until the reader is closed.
+        const ParticleType* getTypes() const;
+        const uint32_t* getColors() const;
+
+    private:
+        bool decodeChunkRle(const uint8_t* payload, size_t payloadSize);
+
+    private:
+        void* m_mapping;
+        size_t m_mappingSize;
+
+        SnapshotHeader m_header;
+        const ParticleType* m_types;
+        const uint32_t* m_colors;
+
+        std::vector<ParticleType> m_decodedTypes;
+        std::vector<uint32_t> m_decodedColors;
+    };
+
+    // Opens a snapshot and loads it into a simulator of the same size, which carries on from
+    // the step and world origin the snapshot was taken at.
+    bool loadSnapshot(const std::string& path, ParticleSimulator& simulator);
+
+    // Writes snapshots on a thread of its own so the caller only pays for the capture. A new
+    // save waits for the previous one to finish.
+    class SnapshotWriter
+    {
+    public:
+        SnapshotWriter() = default;
+        ~SnapshotWriter();
+
+        SnapshotWriter(const SnapshotWriter&) = delete;
+        SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+        void saveAsync(const std::string& path, std::unique_ptr<SnapshotData> data, SnapshotEncoding encoding);
+
+        // Blocks until the save in flight, if any, has finished.
+        void wait();
+
+    private:
+        std::thread m_thread;
+    };
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sasi
+{
+    // Fixed set of worker threads that run batches of independent jobs. The thread calling
+    // parallelFor takes part in the batch, so a pool of N threads starts N - 1 workers.
+    class ThreadPool
+    {
+    public:
+        explicit ThreadPool(int threadCount);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        int getThreadCount() const;
+
+        // Invokes job(i) for every i in [0, count) and returns once all of them have finished.
+        // Jobs must not depend on each other or on the order they run in.
+        void parallelFor(int count, const std::function<void(int)>& job);
+
+    private:
+        void workerLoop();
+        void runJobs();
+
+    private:
+        std::vector<std::thread> m_workers;
+
+        std::mutex m_mutex;
+        std::condition_variable m_workAvailable;
+        std::condition_variable m_workFinished;
+
+        const std::function<void(int)>* m_job;
+        int m_jobCount;
+        std::atomic<int> m_nextJob;
+        int m_busyWorkers;
+        uint64_t m_generation;
+        bool m_isQuitting;
+    };
+}
@@ -1,8 +1,16 @@
 #pragma once
 
+#include <array>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include <bgfx/bgfx.h>
 
+#include "dirty_rect.h"
+#include "lod_pyramid.h"
 #include "particle_simulator.h"
+#include "simulation_thread.h"
 
 namespace sasi
 {
@@ -43,28 +51,142 @@ namespace sasi
         2, 1, 3
     };
 
+    // How the world texture is produced. Color uploads 32 bits of colour per cell. Palette
+    // uploads the 8 bit type of each cell and colours it in the fragment shader, a quarter of
+    // the bytes and no colour copy in the simulator.
+    enum class RenderMode
+    {
+        Color,
+        Palette
+    };
+
+    // A square of the simulator's cells drawn with textures of its own, so no single texture
+    // has to hold the whole grid. Textures are made the first time the tile is seen.
+    struct WorldTile
+    {
+        bgfx::TextureHandle colorTexture = BGFX_INVALID_HANDLE;
+        bgfx::TextureHandle typeTexture = BGFX_INVALID_HANDLE;
+
+        // Cells changed since the texture of the active render mode was last uploaded.
+        DirtyRect pending;
+    };
+
+    // The tiles of one level of detail. Level 0 draws each of the simulator's cells with a texel
+    // and every level after it draws the level of the LOD pyramid with the same number.
+    struct WorldLevel
+    {
+        std::vector<WorldTile> tiles;
+        int tileCountX;
+        int tileCountY;
+    };
+
     class World
     {
     private:
         ParticleSimulator m_simulator;
+        SimulationThread m_simulationThread;
         bgfx::VertexBufferHandle m_vbh;
         bgfx::IndexBufferHandle m_ibh;
         bgfx::ProgramHandle m_ph;
-        bgfx::TextureHandle m_textureHandle;
         bgfx::UniformHandle m_textureSampler;
 
+        bgfx::ProgramHandle m_palettePh;
+        bgfx::TextureHandle m_paletteTextureHandle;
+        bgfx::UniformHandle m_typeSampler;
+        bgfx::UniformHandle m_paletteSampler;
+        bgfx::UniformHandle m_paletteParams;
+        bgfx::UniformHandle m_paletteOffset;
+
+        RenderMode m_renderMode;
+
         std::unique_ptr<Camera> m_camera;
 
         const InputState* m_inputState;
 
         uint64_t m_startTimeMs;
         double m_previousTickTimeSecs;
-        double m_fixedTimeAccumulationSecs;
 
         int m_backbufferWidth;
         int m_backbufferHeight;
 
+        // What the mouse paints, and its radius in cells. While the button is held each frame
+        // strokes from where the mouse was the frame before.
+        ParticleType m_brushType;
+        int m_brushRadius;
+
+        // Types of the materials loaded so far, which the 4 key cycles the brush through.
+        // Filled in by the simulation thread as it registers them.
+        std::vector<ParticleType> m_materialTypes;
+
+        // Colour of every particle type, built by the simulation thread whenever types are
+        // registered and uploaded by the next render while m_isPaletteNew is set.
+        std::array<uint32_t, ParticleRegistry::k_maxParticleTypes> m_palette;
+        bool m_isPaletteNew;
+
+        // Guards the material types and the palette.
+        std::mutex m_materialMutex;
+
+        bool m_isBrushDown;
+        float m_previousBrushX;
+        float m_previousBrushY;
+
+        // Stats carried by the most recent simulation frame.
+        SchedulerStats m_schedulerStats;
+        MetricsSummary m_metrics;
+        StreamingStats m_streamingStats;
+
+        // World cell shown by the top left texel of the top left tile.
+        int m_worldOriginX;
+        int m_worldOriginY;
+
+        // Downsampled copies of the latest frame for zoomed out views, kept up to date with the
+        // regions that change from frame to frame.
+        LodPyramid m_lodPyramid;
+
+        // Tiles covering each level row by row, k_tileSize texels square apart from those on
+        // the right and bottom edges. Only the level matching the camera's zoom is uploaded
+        // and drawn, the rest collect changes until they are used.
+        std::vector<WorldLevel> m_levels;
+
+        // Regions of the latest simulation frame that changed, before being split between tiles.
+        std::vector<DirtyRect> m_dirtyRects;
+
+    private:
+        // Adds the changed regions of the latest simulation frame to the LOD pyramid and to the
+        // tiles they touch on every level, then uploads the pending regions of the visible tiles
+        // of one level from its colours or types, depending on the render mode. Tiles out of
+        // view keep theirs until seen.
+        void uploadTiles(int level, int minTileX, int minTileY, int maxTileX, int maxTileY);
+
+        // Finds the range of a level's tiles the camera can see. Returns false if it sees none.
+        bool findVisibleTiles(int level, int& outMinTileX, int& outMinTileY, int& outMaxTileX, int& outMaxTileY) const;
+
+        // The most detailed level with no more than one texel per pixel at the camera's zoom.
+        int pickLevel() const;
+
+        // Texels of a level covered by a tile, clipped to the level.
+        DirtyRect getTileBounds(int level, int tileX, int tileY) const;
+
+        // Makes every tile upload all of its cells the next time it is seen.
+        void markAllTilesPending();
+
+        // Builds the palette for the next render to upload. Must run on the simulation thread,
+        // other threads queue it there with requestPalette.
+        void publishPalette(const ParticleSimulator& simulator);
+        void requestPalette();
+
+        // Uploads the palette to the palette texture if the simulation thread built a new one.
+        void uploadPalette();
+
     public:
+        // Cells along each side of a tile. Small enough for any device's texture limit, large
+        // enough to keep the number of draws low.
+        static constexpr int k_tileSize = 256;
+
+        // Levels of detail, enough for each texel to cover no less than a pixel at the camera's
+        // furthest zoom.
+        static constexpr int k_levelCount = 7;
+
         World(int width, int height, uint64_t startTimeM, const InputState* inputState);
         ~World();
 
@@ -72,5 +194,33 @@ namespace sasi
         void render(int frame, bgfx::ViewId viewId);
 
         void updateBackbufferWidthHeight(int width, int height);
+
+        void setRenderMode(RenderMode renderMode);
+        RenderMode getRenderMode() const;
+
+        // Starts streaming per-step simulation metrics to a CSV file.
+        void openMetricsCsv(const std::string& path);
+
+        // Saves the world to a snapshot in the background, or replaces it with one before the
+        // next step.
+        void saveSnapshot(const std::string& path);
+        void loadSnapshot(const std::string& path);
+
+        // Streams an unbounded world through the simulator around the camera, paging chunks
+        // that fall out of the simulated region to a scratch file.
+        void enableStreaming(const std::string& pageFilePath);
+
+        // Loads material definitions and registers them with the simulator before its next
+        // step. Returns false if the file could not be read or parsed.
+        bool loadMaterials(const std::string& path);
+
+        // Records brush input to a file, or replays a recording in place of live input. See
+        // SimulationThread.
+        void startRecording(const std::string& path);
+        bool startReplay(const std::string& path);
+
+        const SchedulerStats& getSchedulerStats() const;
+        const MetricsSummary& getMetrics() const;
+        const StreamingStats& getStreamingStats() const;
     };
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+$input v_texcoord0
+
+#include <bgfx_shader.sh>
+
+// Cell types, one per texel, and the colour of each type.
+SAMPLER2D(s_texType, 0);
+SAMPLER2D(s_texPalette, 1);
+
+// x: strength of the per-cell shade variation, zero for flat colours.
+// yz: size of the type texture in cells.
+uniform vec4 u_paletteParams;
+
+// xy: grid cell of the type texture's top left texel, so shades carry on across textures.
+uniform vec4 u_paletteOffset;
+
+float hashCell(vec2 cell)
+{
+	return fract(sin(dot(cell, vec2(12.9898, 78.233))) * 43758.5453);
+}
+
+void main()
+{
+	float type = texture2D(s_texType, v_texcoord0).x * 255.0;
+	vec4 color = texture2D(s_texPalette, vec2((type + 0.5) / 256.0, 0.5));
+
+	vec2 cell = floor(v_texcoord0 * u_paletteParams.yz) + u_paletteOffset.xy;
+	float shade = 1.0 - (u_paletteParams.x * hashCell(cell));
+	gl_FragColor = vec4(color.rgb * shade, color.a);
+}
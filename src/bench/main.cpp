@@ -0,0 +1,370 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "particle.h"
+#include "particle_simulator.h"
+
+namespace
+{
+    // Cell steps each run aims for when no step count is given, so every grid size takes
+    // roughly as long to measure.
+    const double k_defaultCellSteps = 2.5e8;
+    const int k_maxDefaultSteps = 2000;
+
+    struct BenchOptions
+    {
+        std::vector<std::string> scenarios;
+        std::vector<int> sizes = { 160, 1024, 4096 };
+        int steps = 0;
+        unsigned int seed = 1u;
+        int threads = 1;
+        bool rowKernels = true;
+        sasi::SimulationBackend backend = sasi::SimulationBackend::CellScan;
+        bool velocity = false;
+    };
+
+    // Fills the grid before the first step and, for scenarios with a source, adds particles
+    // before every step. Both are left out of the timings.
+    struct Scenario
+    {
+        const char* name;
+        void (*setup)(sasi::ParticleSimulator& simulator, std::mt19937& generator);
+        void (*feed)(sasi::ParticleSimulator& simulator, int step);
+    };
+
+    void fillRect(sasi::ParticleSimulator& simulator, int minX, int minY, int maxX, int maxY, sasi::ParticleType type)
+    {
+        const sasi::Particle particle = simulator.make(type);
+        for (int y = minY; y < maxY; ++y)
+        {
+            for (int x = minX; x < maxX; ++x)
+            {
+                simulator.setParticle(x, y, particle);
+            }
+        }
+    }
+
+    // A block of sand over the middle of the grid collapsing into a pile.
+    void setupAvalanche(sasi::ParticleSimulator& simulator, std::mt19937& generator)
+    {
+        const int width = simulator.getColorDataWidth();
+        const int height = simulator.getColorDataHeight();
+        fillRect(simulator, width / 4, 0, (width * 3) / 4, height / 2, sasi::ParticleType::Sand);
+    }
+
+    // A tap pouring water into a tank that already holds a little.
+    void setupWaterTank(sasi::ParticleSimulator& simulator, std::mt19937& generator)
+    {
+        const int width = simulator.getColorDataWidth();
+        const int height = simulator.getColorDataHeight();
+        fillRect(simulator, 0, (height * 7) / 8, width, height, sasi::ParticleType::Water);
+    }
+
+    void feedWaterTank(sasi::ParticleSimulator& simulator, int step)
+    {
+        const int width = simulator.getColorDataWidth();
+        fillRect(simulator, (width * 7) / 16, 0, (width * 9) / 16, 1, sasi::ParticleType::Water);
+    }
+
+    // A column of sand sinking through a pool of water.
+    void setupSandThroughWater(sasi::ParticleSimulator& simulator, std::mt19937& generator)
+    {
+        const int width = simulator.getColorDataWidth();
+        const int height = simulator.getColorDataHeight();
+        fillRect(simulator, 0, height / 2, width, height, sasi::ParticleType::Water);
+        fillRect(simulator, (width * 3) / 8, 0, (width * 5) / 8, height / 4, sasi::ParticleType::Sand);
+    }
+
+    // Packed sand under rows full of water, where nothing can move.
+    void setupSettled(sasi::ParticleSimulator& simulator, std::mt19937& generator)
+    {
+        const int width = simulator.getColorDataWidth();
+        const int height = simulator.getColorDataHeight();
+        fillRect(simulator, 0, height / 2, width, height, sasi::ParticleType::Sand);
+        fillRect(simulator, 0, height / 4, width, height / 2, sasi::ParticleType::Water);
+    }
+
+    // Every cell void, sand or water at random, which keeps every chunk awake.
+    void setupNoise(sasi::ParticleSimulator& simulator, std::mt19937& generator)
+    {
+        const sasi::Particle particles[3] = {
+            simulator.make(sasi::ParticleType::Void),
+            simulator.make(sasi::ParticleType::Sand),
+            simulator.make(sasi::ParticleType::Water) };
+
+        std::uniform_int_distribution<int> distribution(0, 2);
+        const int width = simulator.getColorDataWidth();
+        const int height = simulator.getColorDataHeight();
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                simulator.setParticle(x, y, particles[distribution(generator)]);
+            }
+        }
+    }
+
+    const Scenario k_scenarios[] =
+    {
+        { "avalanche", setupAvalanche, nullptr },
+        { "water-tank", setupWaterTank, feedWaterTank },
+        { "sand-through-water", setupSandThroughWater, nullptr },
+        { "settled", setupSettled, nullptr },
+        { "noise", setupNoise, nullptr },
+    };
+
+    const Scenario* findScenario(const std::string& name)
+    {
+        for (const Scenario& scenario : k_scenarios)
+        {
+            if (name == scenario.name)
+            {
+                return &scenario;
+            }
+        }
+        return nullptr;
+    }
+
+    void printUsage()
+    {
+        // Let any error explaining why we got here out first.
+        sasi::flushLog();
+
+        std::cout
+            << "Usage: sasi-bench [options]\n"
+            << "  --scenario <name>   Scenario to run, may be repeated (default all).\n"
+            << "                      One of avalanche, water-tank, sand-through-water, settled, noise.\n"
+            << "  --size <cells>      Side of the square grid, may be repeated (default 160, 1024 and 4096).\n"
+            << "  --steps <count>     Steps per run (default scales with the grid, up to "
+            << k_maxDefaultSteps << ").\n"
+            << "  --seed <value>      Seed for scenarios with random content (default 1).\n"
+            << "  --threads <count>   Threads used to tick the grid (default 1).\n"
+            << "  --row-kernels <0|1> Batch uncontested falls with the vectorised row kernel (default 1).\n"
+            << "  --backend <cells|margolus> Per-cell tick functions or the 2x2 block automaton (default cells).\n"
+            << "  --velocity <0|1>    Give sand and water velocities so they cross several cells a step (default 0).\n"
+            << "Prints one JSON object per run.\n";
+    }
+
+    bool parseOptions(int argc, char* argv[], BenchOptions& outOptions)
+    {
+        std::vector<int> sizes;
+        for (int i = 1; i < argc; ++i)
+        {
+            const char* arg = argv[i];
+            if (std::strcmp(arg, "--help") == 0)
+            {
+                return false;
+            }
+
+            if (i + 1 >= argc)
+            {
+                SASI_LOG_ERROR("missing value for %s", arg);
+                return false;
+            }
+
+            const char* value = argv[++i];
+            if (std::strcmp(arg, "--scenario") == 0)
+            {
+                if (findScenario(value) == nullptr)
+                {
+                    SASI_LOG_ERROR("unknown scenario %s", value);
+                    return false;
+                }
+                outOptions.scenarios.push_back(value);
+            }
+            else if (std::strcmp(arg, "--size") == 0)
+            {
+                sizes.push_back(std::atoi(value));
+            }
+            else if (std::strcmp(arg, "--steps") == 0)
+            {
+                outOptions.steps = std::atoi(value);
+            }
+            else if (std::strcmp(arg, "--seed") == 0)
+            {
+                outOptions.seed = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+            }
+            else if (std::strcmp(arg, "--threads") == 0)
+            {
+                outOptions.threads = std::atoi(value);
+            }
+            else if (std::strcmp(arg, "--row-kernels") == 0)
+            {
+                outOptions.rowKernels = std::atoi(value) != 0;
+            }
+            else if (std::strcmp(arg, "--velocity") == 0)
+            {
+                outOptions.velocity = std::atoi(value) != 0;
+            }
+            else if (std::strcmp(arg, "--backend") == 0)
+            {
+                if (std::strcmp(value, "cells") == 0)
+                {
+                    outOptions.backend = sasi::SimulationBackend::CellScan;
+                }
+                else if (std::strcmp(value, "margolus") == 0)
+                {
+                    outOptions.backend = sasi::SimulationBackend::Margolus;
+                }
+                else
+                {
+                    SASI_LOG_ERROR("unknown backend %s", value);
+                    return false;
+                }
+            }
+            else
+            {
+                SASI_LOG_ERROR("unknown option %s", arg);
+                return false;
+            }
+        }
+
+        if (!sizes.empty())
+        {
+            outOptions.sizes = sizes;
+        }
+        if (outOptions.scenarios.empty())
+        {
+            for (const Scenario& scenario : k_scenarios)
+            {
+                outOptions.scenarios.push_back(scenario.name);
+            }
+        }
+
+        for (int size : outOptions.sizes)
+        {
+            if (size <= 0)
+            {
+                SASI_LOG_ERROR("grid sizes must be positive.");
+                return false;
+            }
+        }
+        if (outOptions.steps < 0)
+        {
+            SASI_LOG_ERROR("steps must not be negative.");
+            return false;
+        }
+
+        return true;
+    }
+
+    int getStepCount(const BenchOptions& options, int size)
+    {
+        if (options.steps > 0)
+        {
+            return options.steps;
+        }
+
+        const double cells = static_cast<double>(size) * size;
+        return std::max(1, std::min(k_maxDefaultSteps, static_cast<int>(k_defaultCellSteps / cells)));
+    }
+
+    // Runs one scenario and prints its result. Meant to run in a process of its own so that
+    // the peak resident set size belongs to this run alone.
+    void runScenario(const Scenario& scenario, int size, const BenchOptions& options)
+    {
+        sasi::SimulatorOptions simulatorOptions;
+        simulatorOptions.threadCount = options.threads;
+        simulatorOptions.useRowKernels = options.rowKernels;
+        simulatorOptions.backend = options.backend;
+        simulatorOptions.velocity.enabled = options.velocity;
+
+        std::unique_ptr<sasi::ParticleSimulator> simulator{
+            new sasi::ParticleSimulator{ size, size, simulatorOptions } };
+        std::mt19937 generator(options.seed);
+        scenario.setup(*simulator, generator);
+
+        const int steps = getStepCount(options, size);
+        const double fixedDeltaTime = 1.0 / 30.0;
+
+        using std::chrono::steady_clock;
+        using std::chrono::duration;
+        duration<double> elapsed{ 0.0 };
+        for (int step = 0; step < steps; ++step)
+        {
+            if (scenario.feed != nullptr)
+            {
+                scenario.feed(*simulator, step);
+            }
+
+            const auto start = steady_clock::now();
+            simulator->tick(fixedDeltaTime);
+            elapsed += steady_clock::now() - start;
+        }
+
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+
+        const double elapsedSecs = elapsed.count();
+        const double cells = static_cast<double>(size) * size;
+        std::cout
+            << "{\"scenario\":\"" << scenario.name << "\""
+            << ",\"width\":" << size
+            << ",\"height\":" << size
+            << ",\"threads\":" << options.threads
+            << ",\"row_kernels\":" << (options.rowKernels ? "true" : "false")
+            << ",\"backend\":\"" << ((options.backend == sasi::SimulationBackend::Margolus) ? "margolus" : "cells") << "\""
+            << ",\"velocity\":" << (options.velocity ? "true" : "false")
+            << ",\"steps\":" << steps
+            << ",\"elapsed_s\":" << elapsedSecs
+            << ",\"steps_per_sec\":" << ((elapsedSecs > 0.0) ? steps / elapsedSecs : 0.0)
+            << ",\"ns_per_cell_step\":" << ((elapsedSecs * 1e9) / (cells * steps))
+            << ",\"peak_rss_kb\":" << usage.ru_maxrss
+            << "}\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return -1;
+    }
+
+    int failures = 0;
+    for (const std::string& name : options.scenarios)
+    {
+        const Scenario& scenario = *findScenario(name);
+        for (int size : options.sizes)
+        {
+            // Each run gets a fresh process so peak memory is not carried between them.
+            std::cout.flush();
+            const pid_t pid = fork();
+            if (pid < 0)
+            {
+                SASI_LOG_ERROR("failed to start run of %s", name.c_str());
+                return -1;
+            }
+            if (pid == 0)
+            {
+                runScenario(scenario, size, options);
+                std::cout.flush();
+                _exit(0);
+            }
+
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+            {
+                SASI_LOG_ERROR("run of %s at %d failed", name.c_str(), size);
+                ++failures;
+            }
+        }
+    }
+
+    return (failures == 0) ? 0 : -1;
+}
@@ -25,8 +25,9 @@ void sasi::Camera::getproj(float* result, int width, int height) const
     // a pixels-per-unit of 8 means that 1 square unit contains 64 simulatable pixels.
     //
     // - Zoom
-    // Only supports integer values >= 1. Essentially controls how many pixels are equivalent to a particle. For example
-    // setting a zoom level of 2 means each particle is rendered with 2x2 pixels.
+    // Integer values >= 1, or powers of two below 1. Essentially controls how many pixels are equivalent to a particle.
+    // For example setting a zoom level of 2 means each particle is rendered with 2x2 pixels, and a zoom level of 0.25
+    // fits 4x4 particles in each pixel.
 
     const float halfWidth = width / 2.0f / m_zoom;
     const float halfHeight = height / 2.0f / m_zoom;
@@ -42,14 +43,30 @@ void sasi::Camera::getproj(float* result, int width, int height) const
         bgfx::getCaps()->homogeneousDepth);
 }
 
+void sasi::Camera::getViewBounds(int targetWidth, int targetHeight, float& outMinX, float& outMinY, float& outMaxX, float& outMaxY) const
+{
+    // Matches the orthographic projection built by getproj.
+    const float halfWidth = targetWidth / 2.0f / m_zoom / k_pixelsPerUnit;
+    const float halfHeight = targetHeight / 2.0f / m_zoom / k_pixelsPerUnit;
+    outMinX = m_location.x - halfWidth;
+    outMaxX = m_location.x + halfWidth;
+    outMinY = m_location.y - halfHeight;
+    outMaxY = m_location.y + halfHeight;
+}
+
 void sasi::Camera::zoomIn()
 {
-    m_zoom += 1.0f;
+    m_zoom = (m_zoom < 1.0f) ? (m_zoom * 2.0f) : (m_zoom + 1.0f);
 }
 
 void sasi::Camera::zoomOut()
 {
-    m_zoom = bx::max(1.0f, m_zoom - 1.0f);
+    m_zoom = (m_zoom > 1.0f) ? (m_zoom - 1.0f) : bx::max(k_minZoom, m_zoom / 2.0f);
+}
+
+float sasi::Camera::getZoom() const
+{
+    return m_zoom;
 }
 
 void sasi::Camera::translate(const bx::Vec3& translation)
@@ -57,6 +74,11 @@ void sasi::Camera::translate(const bx::Vec3& translation)
     m_location = bx::add(m_location, translation);
 }
 
+const bx::Vec3& sasi::Camera::getLocation() const
+{
+    return m_location;
+}
+
 bx::Vec3 sasi::Camera::screenToWorldLocation(int width, int height, int x, int y) const
 {
     float zoomScalePixPerUnit = sasi::k_pixelsPerUnit * m_zoom;
@@ -0,0 +1,486 @@
+#include "chunk_streamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.h"
+
+namespace
+{
+    // Weight given to the newest focus velocity sample, the rest comes from earlier ones.
+    const float k_focusVelocitySmoothing = 0.25f;
+
+    bool isInsideRegion(int chunkX, int chunkY, int originX, int originY, int chunksX, int chunksY)
+    {
+        return (chunkX >= originX) && (chunkX < originX + chunksX) && (chunkY >= originY) && (chunkY < originY + chunksY);
+    }
+
+    int floorDiv(int value, int divisor)
+    {
+        return (value >= 0) ? value / divisor : -((-value + divisor - 1) / divisor);
+    }
+}
+
+bool sasi::ChunkCells::isEmpty() const
+{
+    return std::all_of(types, types + k_cellCount, [](ParticleType type) { return type == ParticleType::Void; });
+}
+
+sasi::ChunkPageFile::ChunkPageFile()
+    : m_path({})
+    , m_file(-1)
+    , m_slots({})
+    , m_freeSlots({})
+    , m_slotCount(0u)
+{
+}
+
+sasi::ChunkPageFile::~ChunkPageFile()
+{
+    close();
+}
+
+bool sasi::ChunkPageFile::open(const std::string& path)
+{
+    close();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_file < 0)
+    {
+        SASI_LOG_ERROR("failed to open chunk page file %s", path.c_str());
+        return false;
+    }
+
+    m_path = path;
+    return true;
+}
+
+void sasi::ChunkPageFile::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file < 0)
+    {
+        return;
+    }
+
+    ::close(m_file);
+    std::remove(m_path.c_str());
+    m_file = -1;
+    m_slots.clear();
+    m_freeSlots.clear();
+    m_slotCount = 0u;
+}
+
+bool sasi::ChunkPageFile::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_file >= 0;
+}
+
+bool sasi::ChunkPageFile::contains(const ChunkKey& key) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_slots.find(key) != m_slots.end();
+}
+
+bool sasi::ChunkPageFile::read(const ChunkKey& key, ChunkCells& outCells) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto slot = m_slots.find(key);
+    if ((m_file < 0) || (slot == m_slots.end()))
+    {
+        return false;
+    }
+
+    const off_t offset = static_cast<off_t>(slot->second * sizeof(ChunkCells));
+    if (::pread(m_file, &outCells, sizeof(ChunkCells), offset) != static_cast<ssize_t>(sizeof(ChunkCells)))
+    {
+        SASI_LOG_ERROR("failed to read chunk %d,%d from %s", key.x, key.y, m_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool sasi::ChunkPageFile::write(const ChunkKey& key, const ChunkCells& cells)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file < 0)
+    {
+        return false;
+    }
+
+    auto slot = m_slots.find(key);
+    if (cells.isEmpty())
+    {
+        if (slot != m_slots.end())
+        {
+            m_freeSlots.push_back(slot->second);
+            m_slots.erase(slot);
+        }
+        return true;
+    }
+
+    if (slot == m_slots.end())
+    {
+        uint64_t index = m_slotCount;
+        if (m_freeSlots.empty())
+        {
+            ++m_slotCount;
+        }
+        else
+        {
+            index = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        }
+        slot = m_slots.emplace(key, index).first;
+    }
+
+    const off_t offset = static_cast<off_t>(slot->second * sizeof(ChunkCells));
+    if (::pwrite(m_file, &cells, sizeof(ChunkCells), offset) != static_cast<ssize_t>(sizeof(ChunkCells)))
+    {
+        SASI_LOG_ERROR("failed to write chunk %d,%d to %s", key.x, key.y, m_path.c_str());
+        m_freeSlots.push_back(slot->second);
+        m_slots.erase(slot);
+        return false;
+    }
+    return true;
+}
+
+size_t sasi::ChunkPageFile::getChunkCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_slots.size();
+}
+
+sasi::ChunkCache::ChunkCache(size_t capacity, ChunkPageFile& pageFile)
+    : m_capacity(capacity)
+    , m_pageFile(pageFile)
+    , m_entries()
+    , m_lookup({})
+    , m_putCount(0u)
+{
+}
+
+void sasi::ChunkCache::put(const ChunkKey& key, const ChunkCells& cells)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_putCount;
+
+    const auto found = m_lookup.find(key);
+    if (found != m_lookup.end())
+    {
+        m_entries.erase(found->second);
+        m_lookup.erase(found);
+    }
+
+    // Nothing needs keeping for an empty chunk, but an older copy in the page file has to go.
+    if (cells.isEmpty())
+    {
+        m_pageFile.write(key, cells);
+        return;
+    }
+
+    insert(key, std::unique_ptr<ChunkCells>(new ChunkCells(cells)));
+}
+
+bool sasi::ChunkCache::take(const ChunkKey& key, ChunkCells& outCells, bool& outWasCached)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // A prefetch still reading this chunk must not bring back the copy we hand out.
+    ++m_putCount;
+
+    const auto found = m_lookup.find(key);
+    if (found != m_lookup.end())
+    {
+        outCells = *found->second->cells;
+        m_entries.erase(found->second);
+        m_lookup.erase(found);
+        outWasCached = true;
+        return true;
+    }
+
+    outWasCached = false;
+    return m_pageFile.read(key, outCells);
+}
+
+void sasi::ChunkCache::prefetch(const ChunkKey& key)
+{
+    uint64_t putCount = 0u;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if ((m_lookup.find(key) != m_lookup.end()) || !m_pageFile.contains(key))
+        {
+            return;
+        }
+        putCount = m_putCount;
+    }
+
+    std::unique_ptr<ChunkCells> cells{ new ChunkCells() };
+    if (!m_pageFile.read(key, *cells))
+    {
+        return;
+    }
+
+    // Anything put or taken meanwhile may have made what we read stale, so drop it. The
+    // chunk is read again when it is needed.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if ((putCount != m_putCount) || (m_lookup.find(key) != m_lookup.end()))
+    {
+        return;
+    }
+    insert(key, std::move(cells));
+}
+
+size_t sasi::ChunkCache::getSize() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+void sasi::ChunkCache::insert(const ChunkKey& key, std::unique_ptr<ChunkCells> cells)
+{
+    m_entries.push_front(Entry{ key, std::move(cells) });
+    m_lookup[key] = m_entries.begin();
+
+    while (m_entries.size() > m_capacity)
+    {
+        Entry& oldest = m_entries.back();
+        m_pageFile.write(oldest.key, *oldest.cells);
+        m_lookup.erase(oldest.key);
+        m_entries.pop_back();
+    }
+}
+
+sasi::ChunkStreamer::ChunkStreamer(ParticleSimulator& simulator, const StreamingOptions& options)
+    : m_simulator(simulator)
+    , m_options(options)
+    , m_cache(options.cacheCapacity, m_pageFile)
+    , m_isEnabled(false)
+    , m_regionChunksX(simulator.getChunkCountX())
+    , m_regionChunksY(simulator.getChunkCountY())
+    , m_focusX(0.0f)
+    , m_focusY(0.0f)
+    , m_focusVelocityX(0.0f)
+    , m_focusVelocityY(0.0f)
+    , m_hasFocus(false)
+    , m_regionMoves(0u)
+    , m_chunksPagedIn(0u)
+    , m_chunksFromCache(0u)
+    , m_prefetchQueue({})
+    , m_isQuitting(false)
+    , m_scratch(new ChunkCells())
+{
+    const int chunkSize = ParticleSimulator::k_chunkSize;
+    if (((simulator.getColorDataWidth() % chunkSize) != 0) || ((simulator.getColorDataHeight() % chunkSize) != 0))
+    {
+        SASI_LOG_ERROR("streaming needs a grid that is a whole number of %d cell chunks.", chunkSize);
+        return;
+    }
+    if (((simulator.getWorldOriginX() % chunkSize) != 0) || ((simulator.getWorldOriginY() % chunkSize) != 0))
+    {
+        SASI_LOG_ERROR("streaming needs the world origin on a chunk border.");
+        return;
+    }
+    if (!m_pageFile.open(options.pageFilePath))
+    {
+        return;
+    }
+
+    m_isEnabled = true;
+    m_prefetchThread = std::thread(&ChunkStreamer::prefetchLoop, this);
+}
+
+sasi::ChunkStreamer::~ChunkStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        m_isQuitting = true;
+    }
+    m_prefetchWake.notify_all();
+
+    if (m_prefetchThread.joinable())
+    {
+        m_prefetchThread.join();
+    }
+}
+
+bool sasi::ChunkStreamer::isEnabled() const
+{
+    return m_isEnabled;
+}
+
+void sasi::ChunkStreamer::setFocus(float cellX, float cellY)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (m_hasFocus)
+    {
+        const float elapsedSecs = std::chrono::duration<float>(now - m_focusTime).count();
+        if (elapsedSecs > 0.0f)
+        {
+            const float velocityX = (cellX - m_focusX) / elapsedSecs;
+            const float velocityY = (cellY - m_focusY) / elapsedSecs;
+            m_focusVelocityX += (velocityX - m_focusVelocityX) * k_focusVelocitySmoothing;
+            m_focusVelocityY += (velocityY - m_focusVelocityY) * k_focusVelocitySmoothing;
+        }
+    }
+
+    m_focusX = cellX;
+    m_focusY = cellY;
+    m_focusTime = now;
+    m_hasFocus = true;
+}
+
+bool sasi::ChunkStreamer::update()
+{
+    if (!m_isEnabled || !m_hasFocus)
+    {
+        return false;
+    }
+
+    const int originX = m_simulator.getWorldOriginX() / ParticleSimulator::k_chunkSize;
+    const int originY = m_simulator.getWorldOriginY() / ParticleSimulator::k_chunkSize;
+
+    int targetX = 0;
+    int targetY = 0;
+    centreOriginOn(m_focusX, m_focusY, targetX, targetY);
+    // Small regions get a smaller margin so the focus never strays out of them.
+    const int marginX = std::min(m_options.recentreMargin, m_regionChunksX / 4);
+    const int marginY = std::min(m_options.recentreMargin, m_regionChunksY / 4);
+    const int moveX = (std::abs(targetX - originX) > marginX) ? targetX - originX : 0;
+    const int moveY = (std::abs(targetY - originY) > marginY) ? targetY - originY : 0;
+    if ((moveX != 0) || (moveY != 0))
+    {
+        moveRegion(moveX, moveY);
+    }
+
+    // Read ahead of where the focus is heading, so the chunks are in memory by the time the
+    // region gets there.
+    const float lookahead = static_cast<float>(m_options.prefetchLookaheadSecs);
+    int predictedX = 0;
+    int predictedY = 0;
+    centreOriginOn(m_focusX + (m_focusVelocityX * lookahead), m_focusY + (m_focusVelocityY * lookahead), predictedX, predictedY);
+    if ((predictedX != originX + moveX) || (predictedY != originY + moveY))
+    {
+        queuePrefetch(predictedX, predictedY);
+    }
+
+    return (moveX != 0) || (moveY != 0);
+}
+
+sasi::StreamingStats sasi::ChunkStreamer::getStats() const
+{
+    StreamingStats stats;
+    stats.originChunkX = m_simulator.getWorldOriginX() / ParticleSimulator::k_chunkSize;
+    stats.originChunkY = m_simulator.getWorldOriginY() / ParticleSimulator::k_chunkSize;
+    stats.cachedChunks = m_cache.getSize();
+    stats.pagedChunks = m_pageFile.getChunkCount();
+    stats.regionMoves = m_regionMoves;
+    stats.chunksPagedIn = m_chunksPagedIn;
+    stats.chunksFromCache = m_chunksFromCache;
+    return stats;
+}
+
+void sasi::ChunkStreamer::moveRegion(int chunksX, int chunksY)
+{
+    const int chunkSize = ParticleSimulator::k_chunkSize;
+    const int originX = m_simulator.getWorldOriginX() / chunkSize;
+    const int originY = m_simulator.getWorldOriginY() / chunkSize;
+    const int newOriginX = originX + chunksX;
+    const int newOriginY = originY + chunksY;
+
+    // Page out the chunks the region is leaving.
+    for (int chunkY = 0; chunkY < m_regionChunksY; ++chunkY)
+    {
+        for (int chunkX = 0; chunkX < m_regionChunksX; ++chunkX)
+        {
+            const ChunkKey key{ originX + chunkX, originY + chunkY };
+            if (isInsideRegion(key.x, key.y, newOriginX, newOriginY, m_regionChunksX, m_regionChunksY))
+            {
+                continue;
+            }
+
+            m_simulator.readChunkCells(chunkX, chunkY, m_scratch->types, m_scratch->colors);
+            m_cache.put(key, *m_scratch);
+        }
+    }
+
+    m_simulator.scrollWorld(chunksX * chunkSize, chunksY * chunkSize);
+
+    // Page in the chunks it is reaching. The scroll left them empty.
+    for (int chunkY = 0; chunkY < m_regionChunksY; ++chunkY)
+    {
+        for (int chunkX = 0; chunkX < m_regionChunksX; ++chunkX)
+        {
+            const ChunkKey key{ newOriginX + chunkX, newOriginY + chunkY };
+            if (isInsideRegion(key.x, key.y, originX, originY, m_regionChunksX, m_regionChunksY))
+            {
+                continue;
+            }
+
+            bool wasCached = false;
+            if (m_cache.take(key, *m_scratch, wasCached))
+            {
+                m_simulator.writeChunkCells(chunkX, chunkY, m_scratch->types, m_scratch->colors);
+                ++m_chunksPagedIn;
+                m_chunksFromCache += wasCached ? 1u : 0u;
+            }
+        }
+    }
+
+    ++m_regionMoves;
+}
+
+void sasi::ChunkStreamer::centreOriginOn(float cellX, float cellY, int& outChunkX, int& outChunkY) const
+{
+    const int chunkSize = ParticleSimulator::k_chunkSize;
+    outChunkX = floorDiv(static_cast<int>(std::floor(cellX)), chunkSize) - (m_regionChunksX / 2);
+    outChunkY = floorDiv(static_cast<int>(std::floor(cellY)), chunkSize) - (m_regionChunksY / 2);
+}
+
+void sasi::ChunkStreamer::queuePrefetch(int originChunkX, int originChunkY)
+{
+    const int residentX = m_simulator.getWorldOriginX() / ParticleSimulator::k_chunkSize;
+    const int residentY = m_simulator.getWorldOriginY() / ParticleSimulator::k_chunkSize;
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        m_prefetchQueue.clear();
+        for (int chunkY = 0; chunkY < m_regionChunksY; ++chunkY)
+        {
+            for (int chunkX = 0; chunkX < m_regionChunksX; ++chunkX)
+            {
+                const ChunkKey key{ originChunkX + chunkX, originChunkY + chunkY };
+                if (!isInsideRegion(key.x, key.y, residentX, residentY, m_regionChunksX, m_regionChunksY))
+                {
+                    m_prefetchQueue.push_back(key);
+                }
+            }
+        }
+    }
+    m_prefetchWake.notify_one();
+}
+
+void sasi::ChunkStreamer::prefetchLoop()
+{
+    while (true)
+    {
+        ChunkKey key{};
+        {
+            std::unique_lock<std::mutex> lock(m_prefetchMutex);
+            m_prefetchWake.wait(lock, [this]() { return m_isQuitting || !m_prefetchQueue.empty(); });
+            if (m_isQuitting)
+            {
+                return;
+            }
+            key = m_prefetchQueue.back();
+            m_prefetchQueue.pop_back();
+        }
+
+        m_cache.prefetch(key);
+    }
+}
@@ -0,0 +1,70 @@
+#include "dirty_rect.h"
+
+namespace
+{
+    // A merge may cover at most this much more area than the two rects it replaces, in eighths.
+    const long long k_maxMergeGrowthEighths = 10;
+
+    // How many of the most recent survivors a rect is compared against.
+    const size_t k_maxMergeLookback = 64;
+
+    bool isWorthMerging(const sasi::DirtyRect& a, const sasi::DirtyRect& b)
+    {
+        // Only rects that touch or overlap are candidates.
+        if ((a.maxX + 1 < b.minX) || (b.maxX + 1 < a.minX) || (a.maxY + 1 < b.minY) || (b.maxY + 1 < a.minY))
+        {
+            return false;
+        }
+
+        sasi::DirtyRect merged = a;
+        merged.expand(b.minX, b.minY, b.maxX, b.maxY);
+        return (merged.getArea() * 8) <= ((a.getArea() + b.getArea()) * k_maxMergeGrowthEighths);
+    }
+}
+
+void sasi::mergeDirtyRects(std::vector<DirtyRect>& rects)
+{
+    // First pass folds each rect into the one before it, which joins horizontal runs of chunks.
+    // The second pass folds each run into a recent survivor it suits, which joins vertical
+    // runs. Looking back a bounded number of survivors keeps this linear in the rect count.
+    std::vector<DirtyRect> runs;
+    runs.reserve(rects.size());
+    for (const DirtyRect& rect : rects)
+    {
+        if (rect.isEmpty())
+        {
+            continue;
+        }
+
+        if (!runs.empty() && isWorthMerging(runs.back(), rect))
+        {
+            runs.back().expand(rect.minX, rect.minY, rect.maxX, rect.maxY);
+            continue;
+        }
+
+        runs.push_back(rect);
+    }
+
+    rects.clear();
+    for (const DirtyRect& run : runs)
+    {
+        const size_t lookbackEnd = (rects.size() > k_maxMergeLookback) ? (rects.size() - k_maxMergeLookback) : 0;
+
+        bool merged = false;
+        for (size_t i = rects.size(); i > lookbackEnd; --i)
+        {
+            DirtyRect& survivor = rects[i - 1];
+            if (isWorthMerging(survivor, run))
+            {
+                survivor.expand(run.minX, run.minY, run.maxX, run.maxY);
+                merged = true;
+                break;
+            }
+        }
+
+        if (!merged)
+        {
+            rects.push_back(run);
+        }
+    }
+}
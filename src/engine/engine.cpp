@@ -1,10 +1,9 @@
 #include "engine/engine.h"
 
-#include <iostream>
-
+#include "log.h"
 #include "world.h"
 
-sasi::Engine::Engine(int initWidth, int initHeight)
+sasi::Engine::Engine(int initWidth, int initHeight, int worldWidth, int worldHeight)
     : m_frame(0ULL)
     , m_isInitialized(false)
     , m_isQuitting(false)
@@ -14,7 +13,7 @@ sasi::Engine::Engine(int initWidth, int initHeight)
     // Initialize SDL video subsystem.
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
     {
-        std::cout << "SASI (ERROR): Failed to initialize SDL. SDL_Error: " << SDL_GetError() << "\n";
+        SASI_LOG_ERROR("Failed to initialize SDL. SDL_Error: %s", SDL_GetError());
         return;
     }
 
@@ -27,7 +26,7 @@ sasi::Engine::Engine(int initWidth, int initHeight)
         SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE));
     if (m_window.get() == nullptr)
     {
-        std::cout << "SASI (ERROR): Failed to create SDL window. SDL_Error: " << SDL_GetError() << "\n";
+        SASI_LOG_ERROR("Failed to create SDL window. SDL_Error: %s", SDL_GetError());
         return;
     }
 
@@ -39,7 +38,7 @@ sasi::Engine::Engine(int initWidth, int initHeight)
     SDL_VERSION(&windowInfo.version);
     if (!SDL_GetWindowWMInfo(m_window.get(), &windowInfo))
     {
-        std::cout << "SASI (ERROR): Failed to access SDL window info. SDL_Error: " << SDL_GetError() << "\n";
+        SASI_LOG_ERROR("Failed to access SDL window info. SDL_Error: %s", SDL_GetError());
         return;
     }
     bgfx::Init init;
@@ -50,7 +49,7 @@ sasi::Engine::Engine(int initWidth, int initHeight)
     init.resolution.reset = BGFX_RESET_VSYNC;
     if (!bgfx::init(init))
     {
-        std::cout << "SASI (ERROR): Failed to initialize BGFX.\n";
+        SASI_LOG_ERROR("Failed to initialize BGFX.");
         return;
     }
 
@@ -66,7 +65,7 @@ sasi::Engine::Engine(int initWidth, int initHeight)
     // Enable debug text.
     bgfx::setDebug(BGFX_DEBUG_TEXT);
 
-    m_world.reset(new World{ 160, 160, SDL_GetTicks64(), &m_inputState });
+    m_world.reset(new World{ worldWidth, worldHeight, SDL_GetTicks64(), &m_inputState });
 }
 
 sasi::Engine::~Engine()
@@ -112,6 +111,7 @@ bool sasi::Engine::tick()
             "Backbuffer %dW x %dH in pixels.",
             stats->width,
             stats->height);
+        printMetrics(1);
 
         bgfx::frame();
         ++m_frame;
@@ -127,6 +127,91 @@ bool sasi::Engine::isInitialized() const
     return m_isInitialized;
 }
 
+void sasi::Engine::openMetricsCsv(const std::string& path)
+{
+    if (m_world.get() != nullptr)
+    {
+        m_world->openMetricsCsv(path);
+    }
+}
+
+void sasi::Engine::loadSnapshot(const std::string& path)
+{
+    if (m_world.get() != nullptr)
+    {
+        m_world->loadSnapshot(path);
+    }
+}
+
+void sasi::Engine::enableStreaming(const std::string& pageFilePath)
+{
+    if (m_world.get() != nullptr)
+    {
+        m_world->enableStreaming(pageFilePath);
+    }
+}
+
+bool sasi::Engine::loadMaterials(const std::string& path)
+{
+    return (m_world.get() != nullptr) && m_world->loadMaterials(path);
+}
+
+void sasi::Engine::startRecording(const std::string& path)
+{
+    if (m_world.get() != nullptr)
+    {
+        m_world->startRecording(path);
+    }
+}
+
+bool sasi::Engine::startReplay(const std::string& path)
+{
+    return (m_world.get() != nullptr) && m_world->startReplay(path);
+}
+
+void sasi::Engine::printMetrics(uint16_t row) const
+{
+    if (m_world.get() == nullptr)
+    {
+        return;
+    }
+
+    const SchedulerStats& scheduler = m_world->getSchedulerStats();
+    const MetricsSummary& metrics = m_world->getMetrics();
+    bgfx::dbgTextPrintf(
+        0,
+        row++,
+        0x0f,
+        "Step %llu, time scale %.2f, %d deferred, %llu dropped.",
+        static_cast<unsigned long long>(metrics.stepCount),
+        scheduler.timeScale,
+        scheduler.deferredSteps,
+        static_cast<unsigned long long>(scheduler.droppedSteps));
+    bgfx::dbgTextPrintf(0, row++, 0x0f, "                   p50       p99       max");
+
+    auto printSummary = [&row](const char* name, const MetricSummary& summary)
+    {
+        bgfx::dbgTextPrintf(0, row++, 0x0f, "%-16s %9.2f %9.2f %9.2f", name, summary.p50, summary.p99, summary.max);
+    };
+    printSummary("Tick ms", metrics.tickMs);
+    printSummary("Colour ms", metrics.colorMs);
+    printSummary("Particles ticked", metrics.particlesTicked);
+    printSummary("Particles moved", metrics.particlesMoved);
+    printSummary("Active chunks", metrics.activeChunks);
+    printSummary("Steps/update", metrics.stepsPerUpdate);
+
+    const StreamingStats& streaming = m_world->getStreamingStats();
+    bgfx::dbgTextPrintf(
+        0,
+        row++,
+        0x0f,
+        "Region at chunk %d,%d, %zu chunks cached, %zu paged out.",
+        streaming.originChunkX,
+        streaming.originChunkY,
+        streaming.cachedChunks,
+        streaming.pagedChunks);
+}
+
 void sasi::Engine::pollEvents()
 {
     SDL_Event event;
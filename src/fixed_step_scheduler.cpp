@@ -0,0 +1,89 @@
+#include "fixed_step_scheduler.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Weight given to the newest sample by the running averages.
+    const double k_averageWeight = 0.1;
+}
+
+sasi::FixedStepScheduler::FixedStepScheduler(const SchedulerOptions& options)
+    : m_options(options)
+    , m_stats({})
+    , m_accumulationSecs(0.0)
+    , m_stepIntervalSecs(options.fixedDeltaTime)
+    , m_stepsThisUpdate(0)
+{
+    m_options.maxStepsPerUpdate = std::max(m_options.maxStepsPerUpdate, 1);
+    m_options.maxDeferredSteps = std::max(m_options.maxDeferredSteps, 0);
+    m_options.maxStepLoad = std::max(m_options.maxStepLoad, 0.01);
+    m_options.minTimeScale = std::min(std::max(m_options.minTimeScale, 0.01), 1.0);
+}
+
+void sasi::FixedStepScheduler::advance(double elapsedSecs)
+{
+    m_accumulationSecs += std::max(elapsedSecs, 0.0);
+}
+
+double sasi::FixedStepScheduler::getTimeUntilNextStep() const
+{
+    return std::max(m_stepIntervalSecs - m_accumulationSecs, 0.0);
+}
+
+bool sasi::FixedStepScheduler::shouldStep(double updateElapsedSecs) const
+{
+    if ((m_accumulationSecs < m_stepIntervalSecs) || (m_stepsThisUpdate >= m_options.maxStepsPerUpdate))
+    {
+        return false;
+    }
+
+    // Always make some progress, then only start steps expected to finish within budget.
+    return (m_stepsThisUpdate == 0) || ((updateElapsedSecs + m_stats.averageStepSecs) <= m_options.updateBudgetSecs);
+}
+
+void sasi::FixedStepScheduler::onStepFinished(double stepSecs)
+{
+    m_accumulationSecs -= m_stepIntervalSecs;
+    ++m_stepsThisUpdate;
+
+    m_stats.averageStepSecs = (m_stats.averageStepSecs == 0.0)
+        ? stepSecs
+        : m_stats.averageStepSecs + ((stepSecs - m_stats.averageStepSecs) * k_averageWeight);
+}
+
+void sasi::FixedStepScheduler::finishUpdate()
+{
+    int dueSteps = static_cast<int>(m_accumulationSecs / m_stepIntervalSecs);
+    if (dueSteps > m_options.maxDeferredSteps)
+    {
+        const int droppedSteps = dueSteps - m_options.maxDeferredSteps;
+        m_accumulationSecs -= droppedSteps * m_stepIntervalSecs;
+        m_stats.droppedSteps += static_cast<uint64_t>(droppedSteps);
+        dueSteps = m_options.maxDeferredSteps;
+    }
+
+    m_stats.stepsLastUpdate = m_stepsThisUpdate;
+    m_stats.deferredSteps = dueSteps;
+    m_stepsThisUpdate = 0;
+
+    if (m_options.adaptStepRate && (m_stats.averageStepSecs > 0.0))
+    {
+        // Ease the interval towards one that leaves steps their share of the wall clock.
+        const double targetIntervalSecs = std::min(
+            std::max(m_stats.averageStepSecs / m_options.maxStepLoad, m_options.fixedDeltaTime),
+            m_options.fixedDeltaTime / m_options.minTimeScale);
+        m_stepIntervalSecs += (targetIntervalSecs - m_stepIntervalSecs) * k_averageWeight;
+        m_stats.timeScale = m_options.fixedDeltaTime / m_stepIntervalSecs;
+    }
+}
+
+const sasi::SchedulerStats& sasi::FixedStepScheduler::getStats() const
+{
+    return m_stats;
+}
+
+double sasi::FixedStepScheduler::getFixedDeltaTime() const
+{
+    return m_options.fixedDeltaTime;
+}
@@ -0,0 +1,546 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "chunk_streamer.h"
+#include "input_recording.h"
+#include "metrics.h"
+#include "log.h"
+#include "material_rules.h"
+#include "particle.h"
+#include "particle_simulator.h"
+#include "snapshot.h"
+
+namespace
+{
+    struct HeadlessOptions
+    {
+        int width = 160;
+        int height = 160;
+        int steps = 1000;
+        bool hasSteps = false;
+        double fill = 0.25;
+        unsigned int seed = 1u;
+        uint32_t randomSeed = 0u;
+        int threads = 1;
+        bool rowKernels = true;
+        bool checkRowKernels = false;
+        sasi::SimulationBackend backend = sasi::SimulationBackend::CellScan;
+        bool velocity = false;
+        std::string metricsCsv;
+        std::string replay;
+        std::string load;
+        std::string save;
+        sasi::SnapshotEncoding saveEncoding = sasi::SnapshotEncoding::Raw;
+        std::string stream;
+        double pan = 0.0;
+        std::string materials;
+    };
+
+    void printUsage()
+    {
+        // Let any error explaining why we got here out first.
+        sasi::flushLog();
+
+        std::cout
+            << "Usage: sasi-headless [options]\n"
+            << "  --width <cells>     Width of the simulated grid (default 160).\n"
+            << "  --height <cells>    Height of the simulated grid (default 160).\n"
+            << "  --steps <count>     Number of fixed steps to run (default 1000).\n"
+            << "  --fill <fraction>   Fraction of the top half seeded with sand and water (default 0.25).\n"
+            << "  --seed <value>      Seed used to scatter the initial particles (default 1).\n"
+            << "  --random-seed <value> Seed of the random choices particles make while ticking (default 0).\n"
+            << "  --threads <count>   Threads used to tick the grid, above one uses the checkerboard update (default 1).\n"
+            << "  --row-kernels <0|1> Batch uncontested falls with the vectorised row kernel (default 1).\n"
+            << "  --check-row-kernels <0|1> Run the same grid without row kernels alongside and fail unless both\n"
+            << "                      end in the same world.\n"
+            << "  --backend <cells|margolus> Per-cell tick functions or the 2x2 block automaton (default cells).\n"
+            << "  --velocity <0|1>    Give sand and water velocities so they cross several cells a step (default 0).\n"
+            << "  --metrics-csv <path> Write the metrics of every step to a CSV file.\n"
+            << "  --replay <path>     Replay a recorded input session with the settings and from the step and world\n"
+            << "                      it was recorded with, overriding the options above. The world is read from\n"
+            << "                      <path>.start unless --load is given. Runs until the last event unless\n"
+            << "                      --steps is given, then prints a checksum of the world. Refuses unless\n"
+            << "                      --materials loads the materials the session was recorded with.\n"
+            << "  --load <path>       Start from a world snapshot instead of scattered particles.\n"
+            << "  --save <path>       Write a world snapshot once the run is over.\n"
+            << "  --save-encoding <raw|rle> Snapshot layout written by --save (default raw).\n"
+            << "  --stream <path>     Stream an unbounded world through the grid, paging chunks to this file.\n"
+            << "  --pan <cells>       Cells the streaming focus moves right every step (default 0).\n"
+            << "  --materials <path>  Load material definitions and scatter them along with sand and water.\n";
+    }
+
+    bool parseOptions(int argc, char* argv[], HeadlessOptions& outOptions)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const char* arg = argv[i];
+            if (std::strcmp(arg, "--help") == 0)
+            {
+                return false;
+            }
+
+            if (i + 1 >= argc)
+            {
+                SASI_LOG_ERROR("missing value for %s", arg);
+                return false;
+            }
+
+            const char* value = argv[++i];
+            if (std::strcmp(arg, "--width") == 0)
+            {
+                outOptions.width = std::atoi(value);
+            }
+            else if (std::strcmp(arg, "--height") == 0)
+            {
+                outOptions.height = std::atoi(value);
+            }
+            else if (std::strcmp(arg, "--steps") == 0)
+            {
+                outOptions.steps = std::atoi(value);
+                outOptions.hasSteps = true;
+            }
+            else if (std::strcmp(arg, "--fill") == 0)
+            {
+                outOptions.fill = std::atof(value);
+            }
+            else if (std::strcmp(arg, "--seed") == 0)
+            {
+                outOptions.seed = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+            }
+            else if (std::strcmp(arg, "--random-seed") == 0)
+            {
+                outOptions.randomSeed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+            }
+            else if (std::strcmp(arg, "--threads") == 0)
+            {
+                outOptions.threads = std::atoi(value);
+            }
+            else if (std::strcmp(arg, "--row-kernels") == 0)
+            {
+                outOptions.rowKernels = std::atoi(value) != 0;
+            }
+            else if (std::strcmp(arg, "--check-row-kernels") == 0)
+            {
+                outOptions.checkRowKernels = std::atoi(value) != 0;
+            }
+            else if (std::strcmp(arg, "--velocity") == 0)
+            {
+                outOptions.velocity = std::atoi(value) != 0;
+            }
+            else if (std::strcmp(arg, "--backend") == 0)
+            {
+                if (std::strcmp(value, "cells") == 0)
+                {
+                    outOptions.backend = sasi::SimulationBackend::CellScan;
+                }
+                else if (std::strcmp(value, "margolus") == 0)
+                {
+                    outOptions.backend = sasi::SimulationBackend::Margolus;
+                }
+                else
+                {
+                    SASI_LOG_ERROR("unknown backend %s", value);
+                    return false;
+                }
+            }
+            else if (std::strcmp(arg, "--metrics-csv") == 0)
+            {
+                outOptions.metricsCsv = value;
+            }
+            else if (std::strcmp(arg, "--replay") == 0)
+            {
+                outOptions.replay = value;
+            }
+            else if (std::strcmp(arg, "--load") == 0)
+            {
+                outOptions.load = value;
+            }
+            else if (std::strcmp(arg, "--save") == 0)
+            {
+                outOptions.save = value;
+            }
+            else if (std::strcmp(arg, "--save-encoding") == 0)
+            {
+                if (std::strcmp(value, "raw") == 0)
+                {
+                    outOptions.saveEncoding = sasi::SnapshotEncoding::Raw;
+                }
+                else if (std::strcmp(value, "rle") == 0)
+                {
+                    outOptions.saveEncoding = sasi::SnapshotEncoding::ChunkRle;
+                }
+                else
+                {
+                    SASI_LOG_ERROR("unknown snapshot encoding %s", value);
+                    return false;
+                }
+            }
+            else if (std::strcmp(arg, "--stream") == 0)
+            {
+                outOptions.stream = value;
+            }
+            else if (std::strcmp(arg, "--pan") == 0)
+            {
+                outOptions.pan = std::atof(value);
+            }
+            else if (std::strcmp(arg, "--materials") == 0)
+            {
+                outOptions.materials = value;
+            }
+            else
+            {
+                SASI_LOG_ERROR("unknown option %s", arg);
+                return false;
+            }
+        }
+
+        if ((outOptions.width <= 0) || (outOptions.height <= 0) || (outOptions.steps < 0))
+        {
+            SASI_LOG_ERROR("width and height must be positive and steps must not be negative.");
+            return false;
+        }
+
+        // Row kernels only run in the cell scan, and streaming pages a single grid.
+        if (outOptions.checkRowKernels
+            && ((outOptions.backend != sasi::SimulationBackend::CellScan) || outOptions.velocity || !outOptions.stream.empty()))
+        {
+            SASI_LOG_ERROR("--check-row-kernels needs the cells backend without velocities or streaming.");
+            return false;
+        }
+
+        return true;
+    }
+
+    // FNV-1a over the type plane, enough to tell whether two runs ended in the same world.
+    uint64_t checksumWorld(const sasi::ParticleSimulator& simulator)
+    {
+        const sasi::ParticleType* types = simulator.getTypeData();
+        uint64_t hash = 14695981039346656037ull;
+        for (int y = 0; y < simulator.getColorDataHeight(); ++y)
+        {
+            const sasi::ParticleType* row = types + (static_cast<size_t>(y) * simulator.getPlaneStride());
+            for (int x = 0; x < simulator.getColorDataWidth(); ++x)
+            {
+                hash = (hash ^ static_cast<uint8_t>(row[x])) * 1099511628211ull;
+            }
+        }
+        return hash;
+    }
+
+    // Scatters sand, water and any loaded materials over the top half of the grid, in equal
+    // shares, so the run has something to move.
+    void seedWorld(sasi::ParticleSimulator& simulator, const HeadlessOptions& options, const std::vector<sasi::ParticleType>& materialTypes)
+    {
+        std::mt19937 generator(options.seed);
+        std::uniform_real_distribution<double> distribution(0.0, 1.0);
+
+        std::vector<sasi::Particle> particles{ simulator.make(sasi::ParticleType::Sand), simulator.make(sasi::ParticleType::Water) };
+        for (sasi::ParticleType type : materialTypes)
+        {
+            particles.push_back(simulator.make(type));
+        }
+
+        for (int y = 0; y < options.height / 2; ++y)
+        {
+            for (int x = 0; x < options.width; ++x)
+            {
+                const double roll = distribution(generator);
+                if (roll < options.fill)
+                {
+                    const size_t choice = static_cast<size_t>((roll / options.fill) * particles.size());
+                    simulator.setParticle(x, y, particles[std::min(choice, particles.size() - 1)]);
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    HeadlessOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return -1;
+    }
+
+    // A replay brings its own grid and settings, starts from the world saved next to it unless
+    // told otherwise, and runs for as long as it has events.
+    std::unique_ptr<sasi::InputReplay> replay;
+    if (!options.replay.empty())
+    {
+        replay.reset(new sasi::InputReplay());
+        if (!replay->load(options.replay))
+        {
+            return -1;
+        }
+
+        const sasi::RecordingSetup& setup = replay->getSetup();
+        options.width = setup.width;
+        options.height = setup.height;
+        options.randomSeed = setup.randomSeed;
+        options.backend = setup.backend;
+        options.velocity = setup.velocity.enabled;
+        if (setup.isCheckerboard)
+        {
+            options.threads = std::max(options.threads, 2);
+        }
+        else if (setup.backend == sasi::SimulationBackend::CellScan)
+        {
+            options.threads = 1;
+        }
+        if (options.load.empty())
+        {
+            options.load = sasi::getRecordingStartPath(options.replay);
+        }
+        if (!options.hasSteps)
+        {
+            options.steps = static_cast<int>(replay->getLastStep()) + 1;
+        }
+    }
+
+    // A snapshot brings its own grid too, which a replay on top of it has to match.
+    using std::chrono::steady_clock;
+    using std::chrono::duration;
+    sasi::MappedSnapshot snapshot;
+    duration<double> loadElapsed{ 0.0 };
+    if (!options.load.empty())
+    {
+        const auto openStart = steady_clock::now();
+        if (!snapshot.open(options.load))
+        {
+            return -1;
+        }
+        loadElapsed += steady_clock::now() - openStart;
+
+        if ((replay.get() != nullptr) && ((replay->getWidth() != snapshot.getWidth()) || (replay->getHeight() != snapshot.getHeight())))
+        {
+            SASI_LOG_ERROR("the replay and the snapshot were made on grids of different sizes.");
+            return -1;
+        }
+
+        options.width = snapshot.getWidth();
+        options.height = snapshot.getHeight();
+    }
+
+    sasi::SimulatorOptions simulatorOptions;
+    simulatorOptions.threadCount = options.threads;
+    simulatorOptions.useRowKernels = options.rowKernels;
+    simulatorOptions.backend = options.backend;
+    simulatorOptions.velocity.enabled = options.velocity;
+    simulatorOptions.randomSeed = options.randomSeed;
+    if (replay.get() != nullptr)
+    {
+        simulatorOptions.velocity = replay->getSetup().velocity;
+    }
+
+    std::unique_ptr<sasi::ParticleSimulator> simulator{
+        new sasi::ParticleSimulator{ options.width, options.height, simulatorOptions } };
+
+    std::vector<sasi::MaterialDefinition> definitions;
+    std::vector<sasi::ParticleType> materialTypes;
+    if (!options.materials.empty())
+    {
+        if (!sasi::loadMaterialDefinitions(options.materials, definitions))
+        {
+            return -1;
+        }
+
+        for (const sasi::MaterialDefinition& definition : definitions)
+        {
+            const sasi::ParticleType type = simulator->registerMaterial(definition);
+            if (type == sasi::ParticleType::Max)
+            {
+                SASI_LOG_ERROR("no room to register material %s", definition.name.c_str());
+                return -1;
+            }
+            materialTypes.push_back(type);
+        }
+    }
+
+    // The rest of the setup was taken from the recording, but materials come from --materials.
+    if ((replay.get() != nullptr) && !sasi::matchesRecordingSetup(replay->getSetup(), *simulator))
+    {
+        return -1;
+    }
+
+    if (!options.load.empty())
+    {
+        const auto loadStart = steady_clock::now();
+        simulator->loadCells(snapshot.getTypes(), snapshot.getColors());
+        simulator->setStep(snapshot.getStep());
+        simulator->setWorldOrigin(snapshot.getWorldOriginX(), snapshot.getWorldOriginY());
+        loadElapsed += steady_clock::now() - loadStart;
+
+        std::cout << "loaded " << options.load << " in " << (loadElapsed.count() * 1000.0) << "ms\n";
+    }
+    else if (replay.get() == nullptr)
+    {
+        seedWorld(*simulator, options, materialTypes);
+    }
+
+    // The reference grid starts from the same world as the checked one and only differs in
+    // running every cell through its tick function. Its replay keeps its own place.
+    std::unique_ptr<sasi::ParticleSimulator> reference;
+    std::unique_ptr<sasi::InputReplay> referenceReplay;
+    if (options.checkRowKernels)
+    {
+        sasi::SimulatorOptions referenceOptions = simulatorOptions;
+        referenceOptions.useRowKernels = false;
+        reference.reset(new sasi::ParticleSimulator{ options.width, options.height, referenceOptions });
+        for (const sasi::MaterialDefinition& definition : definitions)
+        {
+            reference->registerMaterial(definition);
+        }
+
+        if (!options.load.empty())
+        {
+            reference->loadCells(snapshot.getTypes(), snapshot.getColors());
+            reference->setStep(snapshot.getStep());
+            reference->setWorldOrigin(snapshot.getWorldOriginX(), snapshot.getWorldOriginY());
+        }
+        else if (replay.get() == nullptr)
+        {
+            seedWorld(*reference, options, materialTypes);
+        }
+
+        if (replay.get() != nullptr)
+        {
+            referenceReplay.reset(new sasi::InputReplay());
+            referenceReplay->load(options.replay);
+        }
+    }
+    snapshot.close();
+
+    if (replay.get() != nullptr)
+    {
+        simulator->setStep(replay->getSetup().startStep);
+        if (reference.get() != nullptr)
+        {
+            reference->setStep(replay->getSetup().startStep);
+        }
+    }
+
+    sasi::MetricsRecorder metrics(static_cast<size_t>(std::max(options.steps, 1)));
+    if (!options.metricsCsv.empty() && !metrics.openCsv(options.metricsCsv))
+    {
+        return -1;
+    }
+
+    // The focus starts over the middle of the grid so the region only moves once it pans.
+    std::unique_ptr<sasi::ChunkStreamer> streamer;
+    if (!options.stream.empty())
+    {
+        sasi::StreamingOptions streamingOptions;
+        streamingOptions.pageFilePath = options.stream;
+        streamer.reset(new sasi::ChunkStreamer(*simulator, streamingOptions));
+        if (!streamer->isEnabled())
+        {
+            return -1;
+        }
+    }
+
+    const double fixedDeltaTime = (replay.get() != nullptr) ? replay->getFixedDeltaTime() : 1.0 / 30.0;
+
+    const auto start = steady_clock::now();
+    for (int step = 0; step < options.steps; ++step)
+    {
+        if (replay.get() != nullptr)
+        {
+            replay->applyEventsForStep(static_cast<uint64_t>(step), *simulator);
+        }
+
+        if (streamer.get() != nullptr)
+        {
+            streamer->setFocus(
+                static_cast<float>((options.width / 2) + (options.pan * step)),
+                static_cast<float>(options.height / 2));
+            streamer->update();
+        }
+
+        simulator->tick(fixedDeltaTime);
+        metrics.recordStep(simulator->getLastStepMetrics());
+
+        if (reference.get() != nullptr)
+        {
+            if (referenceReplay.get() != nullptr)
+            {
+                referenceReplay->applyEventsForStep(static_cast<uint64_t>(step), *reference);
+            }
+            reference->tick(fixedDeltaTime);
+        }
+    }
+    const duration<double> elapsed = steady_clock::now() - start;
+
+    const double elapsedSecs = elapsed.count();
+    const double stepsPerSec = (elapsedSecs > 0.0) ? options.steps / elapsedSecs : 0.0;
+    const double cells = static_cast<double>(options.width) * options.height;
+    const double nsPerCellStep = (options.steps > 0) ? (elapsedSecs * 1e9) / (cells * options.steps) : 0.0;
+
+    std::cout
+        << "grid " << options.width << "x" << options.height
+        << ", threads " << options.threads
+        << ", steps " << options.steps
+        << ", elapsed " << elapsedSecs << "s"
+        << ", " << stepsPerSec << " steps/sec"
+        << ", " << nsPerCellStep << " ns/cell/step\n";
+
+    const sasi::MetricsSummary summary = metrics.summarize();
+    std::cout
+        << "tick ms p50 " << summary.tickMs.p50 << " p99 " << summary.tickMs.p99 << " max " << summary.tickMs.max
+        << ", colour ms p50 " << summary.colorMs.p50 << " p99 " << summary.colorMs.p99 << " max " << summary.colorMs.max
+        << ", moved p50 " << summary.particlesMoved.p50
+        << ", active chunks p50 " << summary.activeChunks.p50 << "\n";
+
+    if (streamer.get() != nullptr)
+    {
+        const sasi::StreamingStats stats = streamer->getStats();
+        std::cout
+            << "streamed region at chunk " << stats.originChunkX << "," << stats.originChunkY
+            << ", " << stats.regionMoves << " moves"
+            << ", " << stats.chunksPagedIn << " chunks paged in (" << stats.chunksFromCache << " from cache)"
+            << ", " << stats.cachedChunks << " cached, " << stats.pagedChunks << " in page file\n";
+    }
+
+    if (replay.get() != nullptr)
+    {
+        std::cout << "replayed " << replay->getEvents().size() << " events, world checksum "
+            << std::hex << checksumWorld(*simulator) << std::dec << "\n";
+    }
+
+    if (reference.get() != nullptr)
+    {
+        const uint64_t checksum = checksumWorld(*simulator);
+        const uint64_t referenceChecksum = checksumWorld(*reference);
+        if (checksum != referenceChecksum)
+        {
+            SASI_LOG_ERROR("row kernels ended in world %llx, the per-cell scan in %llx.",
+                static_cast<unsigned long long>(checksum), static_cast<unsigned long long>(referenceChecksum));
+            return -1;
+        }
+        std::cout << "row kernels match the per-cell scan, world checksum " << std::hex << checksum << std::dec << "\n";
+    }
+
+    if (!options.save.empty())
+    {
+        sasi::SnapshotData data;
+        sasi::captureSnapshot(*simulator, data);
+
+        const auto saveStart = steady_clock::now();
+        if (!sasi::writeSnapshot(options.save, data, options.saveEncoding))
+        {
+            return -1;
+        }
+        const duration<double> saveElapsed = steady_clock::now() - saveStart;
+        std::cout << "saved " << options.save << " in " << (saveElapsed.count() * 1000.0) << "ms\n";
+    }
+
+    return 0;
+}
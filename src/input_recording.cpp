@@ -0,0 +1,473 @@
+#include "input_recording.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+
+#include "log.h"
+#include "particle_simulator.h"
+#include "sasi_core.h"
+
+namespace
+{
+    const char k_magic[4] = { 'S', 'R', 'E', 'C' };
+    const uint16_t k_version = 1u;
+
+    // Bits of the setup flags byte.
+    const uint8_t k_checkerboardFlag = 1u << 0;
+    const uint8_t k_velocityFlag = 1u << 1;
+
+    bool isBulkEdit(sasi::InputEventKind kind)
+    {
+        return kind != sasi::InputEventKind::PlaceParticle;
+    }
+
+    // Values are stored little endian whatever the host.
+    void writeBytes(std::ofstream& file, uint64_t value, int byteCount)
+    {
+        char bytes[8];
+        for (int i = 0; i < byteCount; ++i)
+        {
+            bytes[i] = static_cast<char>((value >> (i * 8)) & 0xFFu);
+        }
+        file.write(bytes, byteCount);
+    }
+
+    void writeVarint(std::ofstream& file, uint64_t value)
+    {
+        char bytes[10];
+        int count = 0;
+        do
+        {
+            const uint8_t low = static_cast<uint8_t>(value & 0x7Fu);
+            value >>= 7;
+            bytes[count++] = static_cast<char>(low | ((value != 0u) ? 0x80u : 0u));
+        } while (value != 0u);
+        file.write(bytes, count);
+    }
+
+    void writeFloat(std::ofstream& file, float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        writeBytes(file, bits, 4);
+    }
+
+    void writeString(std::ofstream& file, const std::string& value)
+    {
+        writeVarint(file, value.size());
+        file.write(value.data(), static_cast<std::streamsize>(value.size()));
+    }
+
+    // Reads from a byte buffer, remembering whether it ever ran past the end.
+    struct Reader
+    {
+        const uint8_t* data;
+        size_t size;
+        size_t offset;
+        bool failed;
+
+        uint64_t readBytes(int byteCount)
+        {
+            if (offset + byteCount > size)
+            {
+                failed = true;
+                return 0u;
+            }
+
+            uint64_t value = 0u;
+            for (int i = 0; i < byteCount; ++i)
+            {
+                value |= static_cast<uint64_t>(data[offset + i]) << (i * 8);
+            }
+            offset += byteCount;
+            return value;
+        }
+
+        uint64_t readVarint()
+        {
+            uint64_t value = 0u;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                const uint64_t byte = readBytes(1);
+                if (failed)
+                {
+                    return 0u;
+                }
+
+                value |= (byte & 0x7Fu) << shift;
+                if ((byte & 0x80u) == 0u)
+                {
+                    return value;
+                }
+            }
+
+            failed = true;
+            return 0u;
+        }
+
+        float readFloat()
+        {
+            const uint32_t bits = static_cast<uint32_t>(readBytes(4));
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        double readDouble()
+        {
+            const uint64_t bits = readBytes(8);
+            double value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        std::string readString()
+        {
+            const uint64_t length = readVarint();
+            if (failed || (length > size - offset))
+            {
+                failed = true;
+                return {};
+            }
+
+            const std::string value(reinterpret_cast<const char*>(data + offset), static_cast<size_t>(length));
+            offset += static_cast<size_t>(length);
+            return value;
+        }
+    };
+}
+
+void sasi::applyInputEvent(ParticleSimulator& simulator, const InputEvent& event)
+{
+    switch (event.kind)
+    {
+    case InputEventKind::PlaceParticle:
+        simulator.makeParticleAtWorldLocation(event.particleType, event.worldX, event.worldY);
+        return;
+    default:
+        break;
+    }
+
+    int fromX = 0;
+    int fromY = 0;
+    int toX = 0;
+    int toY = 0;
+    simulator.worldToCell(event.worldX, event.worldY, fromX, fromY);
+    simulator.worldToCell(event.toWorldX, event.toWorldY, toX, toY);
+    const int radius = static_cast<int>(std::lround(event.radius * k_pixelsPerUnit));
+
+    switch (event.kind)
+    {
+    case InputEventKind::FillCircle:
+        simulator.fillCircle(fromX, fromY, radius, event.particleType, event.density, event.seed);
+        break;
+    case InputEventKind::FillRect:
+        simulator.fillRect(fromX, fromY, toX, toY, event.particleType, event.density, event.seed);
+        break;
+    case InputEventKind::Stroke:
+        simulator.fillLine(fromX, fromY, toX, toY, radius, event.particleType, event.density, event.seed);
+        break;
+    default:
+        break;
+    }
+}
+
+sasi::RecordingSetup sasi::describeRecordingSetup(const ParticleSimulator& simulator, double fixedDeltaTime)
+{
+    const SimulatorOptions options = simulator.getOptions();
+
+    RecordingSetup setup;
+    setup.width = simulator.getColorDataWidth();
+    setup.height = simulator.getColorDataHeight();
+    setup.fixedDeltaTime = fixedDeltaTime;
+    setup.startStep = simulator.getStep();
+    setup.randomSeed = options.randomSeed;
+    setup.backend = options.backend;
+    setup.isCheckerboard = (options.backend == SimulationBackend::CellScan) && (options.threadCount > 1);
+    setup.velocity = options.velocity;
+    for (const MaterialDefinition& definition : simulator.getMaterials().getDefinitions())
+    {
+        setup.materialNames.push_back(definition.name);
+    }
+    setup.materialDigest = simulator.getMaterials().getDigest();
+    return setup;
+}
+
+bool sasi::matchesRecordingSetup(const RecordingSetup& setup, const ParticleSimulator& simulator)
+{
+    const RecordingSetup current = describeRecordingSetup(simulator, setup.fixedDeltaTime);
+    if ((setup.width != current.width) || (setup.height != current.height))
+    {
+        SASI_LOG_ERROR("the recording was made on a %dx%d grid, this one is %dx%d", setup.width, setup.height, current.width, current.height);
+        return false;
+    }
+    if (setup.randomSeed != current.randomSeed)
+    {
+        SASI_LOG_ERROR("the recording was made with random seed %u, this simulator uses %u", setup.randomSeed, current.randomSeed);
+        return false;
+    }
+    if ((setup.backend != current.backend) || (setup.isCheckerboard != current.isCheckerboard))
+    {
+        SASI_LOG_ERROR("the recording was made with another backend or update order");
+        return false;
+    }
+    if ((setup.velocity.enabled != current.velocity.enabled)
+        || (setup.velocity.enabled && ((setup.velocity.gravity != current.velocity.gravity) || (setup.velocity.dispersion != current.velocity.dispersion))))
+    {
+        SASI_LOG_ERROR("the recording was made with other velocity settings");
+        return false;
+    }
+    if (setup.materialDigest != current.materialDigest)
+    {
+        // Brushes are recorded as type ids, which only name the same materials if the same
+        // definitions were registered in the same order.
+        std::string recorded;
+        for (const std::string& name : setup.materialNames)
+        {
+            recorded += (recorded.empty() ? "" : ", ") + name;
+        }
+        SASI_LOG_ERROR("the recording was made with other materials loaded (%s)", recorded.empty() ? "none" : recorded.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string sasi::getRecordingStartPath(const std::string& recordingPath)
+{
+    return recordingPath + ".start";
+}
+
+sasi::InputRecorder::InputRecorder()
+    : m_previousStep(0ull)
+    , m_previousTimeUs(0ull)
+{
+}
+
+bool sasi::InputRecorder::open(const std::string& path, const RecordingSetup& setup)
+{
+    close();
+    m_file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_file.is_open())
+    {
+        SASI_LOG_ERROR("failed to open input recording %s", path.c_str());
+        return false;
+    }
+
+    uint64_t deltaBits;
+    std::memcpy(&deltaBits, &setup.fixedDeltaTime, sizeof(deltaBits));
+    const uint8_t flags = (setup.isCheckerboard ? k_checkerboardFlag : 0u) | (setup.velocity.enabled ? k_velocityFlag : 0u);
+
+    m_file.write(k_magic, sizeof(k_magic));
+    writeBytes(m_file, k_version, 2);
+    writeBytes(m_file, 0u, 2);
+    writeBytes(m_file, static_cast<uint32_t>(setup.width), 4);
+    writeBytes(m_file, static_cast<uint32_t>(setup.height), 4);
+    writeBytes(m_file, deltaBits, 8);
+    writeBytes(m_file, setup.startStep, 8);
+    writeBytes(m_file, setup.randomSeed, 4);
+    writeBytes(m_file, static_cast<uint8_t>(setup.backend), 1);
+    writeBytes(m_file, flags, 1);
+    writeFloat(m_file, setup.velocity.gravity);
+    writeFloat(m_file, setup.velocity.dispersion);
+    writeVarint(m_file, setup.materialNames.size());
+    for (const std::string& name : setup.materialNames)
+    {
+        writeString(m_file, name);
+    }
+    writeBytes(m_file, setup.materialDigest, 8);
+
+    m_previousStep = 0ull;
+    m_previousTimeUs = 0ull;
+    return true;
+}
+
+void sasi::InputRecorder::close()
+{
+    if (m_file.is_open())
+    {
+        m_file.close();
+    }
+}
+
+bool sasi::InputRecorder::isOpen() const
+{
+    return m_file.is_open();
+}
+
+void sasi::InputRecorder::record(const InputEvent& event)
+{
+    if (!m_file.is_open())
+    {
+        return;
+    }
+
+    m_file.put(static_cast<char>(event.kind));
+    m_file.put(static_cast<char>(event.particleType));
+    writeVarint(m_file, event.step - m_previousStep);
+    writeVarint(m_file, (event.timeUs >= m_previousTimeUs) ? (event.timeUs - m_previousTimeUs) : 0u);
+    writeFloat(m_file, event.worldX);
+    writeFloat(m_file, event.worldY);
+    if (isBulkEdit(event.kind))
+    {
+        writeFloat(m_file, event.toWorldX);
+        writeFloat(m_file, event.toWorldY);
+        writeFloat(m_file, event.radius);
+        writeFloat(m_file, event.density);
+        writeVarint(m_file, event.seed);
+    }
+
+    m_previousStep = event.step;
+    m_previousTimeUs = std::max(event.timeUs, m_previousTimeUs);
+}
+
+sasi::InputReplay::InputReplay()
+    : m_events({})
+    , m_nextEvent(0)
+    , m_setup({})
+{
+}
+
+bool sasi::InputReplay::load(const std::string& path)
+{
+    m_events.clear();
+    m_nextEvent = 0;
+    m_setup = RecordingSetup{};
+
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+        SASI_LOG_ERROR("failed to open input recording %s", path.c_str());
+        return false;
+    }
+    const std::vector<uint8_t> bytes{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+    Reader reader{ bytes.data(), bytes.size(), 0, false };
+    if ((bytes.size() < sizeof(k_magic)) || (std::memcmp(bytes.data(), k_magic, sizeof(k_magic)) != 0))
+    {
+        SASI_LOG_ERROR("%s is not an input recording", path.c_str());
+        return false;
+    }
+    reader.offset = sizeof(k_magic);
+
+    const uint64_t version = reader.readBytes(2);
+    reader.readBytes(2);
+    if (version != k_version)
+    {
+        SASI_LOG_ERROR("input recording %s has unsupported version %llu", path.c_str(), static_cast<unsigned long long>(version));
+        return false;
+    }
+
+    m_setup.width = static_cast<int>(reader.readBytes(4));
+    m_setup.height = static_cast<int>(reader.readBytes(4));
+    m_setup.fixedDeltaTime = reader.readDouble();
+    m_setup.startStep = reader.readBytes(8);
+    m_setup.randomSeed = static_cast<uint32_t>(reader.readBytes(4));
+    const uint64_t backend = reader.readBytes(1);
+    const uint64_t flags = reader.readBytes(1);
+    m_setup.velocity.gravity = reader.readFloat();
+    m_setup.velocity.dispersion = reader.readFloat();
+    const uint64_t materialCount = reader.readVarint();
+    for (uint64_t i = 0; !reader.failed && (i < materialCount); ++i)
+    {
+        m_setup.materialNames.push_back(reader.readString());
+    }
+    m_setup.materialDigest = reader.readBytes(8);
+
+    m_setup.backend = static_cast<SimulationBackend>(backend);
+    m_setup.isCheckerboard = (flags & k_checkerboardFlag) != 0u;
+    m_setup.velocity.enabled = (flags & k_velocityFlag) != 0u;
+    if (backend > static_cast<uint64_t>(SimulationBackend::Margolus))
+    {
+        reader.failed = true;
+    }
+
+    uint64_t step = 0ull;
+    uint64_t timeUs = 0ull;
+    while (!reader.failed && (reader.offset < reader.size))
+    {
+        InputEvent event;
+        event.kind = static_cast<InputEventKind>(reader.readBytes(1));
+        event.particleType = static_cast<ParticleType>(reader.readBytes(1));
+        step += reader.readVarint();
+        timeUs += reader.readVarint();
+        event.step = step;
+        event.timeUs = timeUs;
+        event.worldX = reader.readFloat();
+        event.worldY = reader.readFloat();
+        if (event.kind > InputEventKind::Stroke)
+        {
+            reader.failed = true;
+        }
+        else if (isBulkEdit(event.kind))
+        {
+            event.toWorldX = reader.readFloat();
+            event.toWorldY = reader.readFloat();
+            event.radius = reader.readFloat();
+            event.density = reader.readFloat();
+            event.seed = static_cast<uint32_t>(reader.readVarint());
+        }
+
+        if (!reader.failed)
+        {
+            m_events.push_back(event);
+        }
+    }
+
+    if (reader.failed)
+    {
+        SASI_LOG_ERROR("input recording %s is truncated or corrupt", path.c_str());
+        m_events.clear();
+        return false;
+    }
+
+    return true;
+}
+
+int sasi::InputReplay::getWidth() const
+{
+    return m_setup.width;
+}
+
+int sasi::InputReplay::getHeight() const
+{
+    return m_setup.height;
+}
+
+double sasi::InputReplay::getFixedDeltaTime() const
+{
+    return m_setup.fixedDeltaTime;
+}
+
+const sasi::RecordingSetup& sasi::InputReplay::getSetup() const
+{
+    return m_setup;
+}
+
+uint64_t sasi::InputReplay::getLastStep() const
+{
+    return m_events.empty() ? 0ull : m_events.back().step;
+}
+
+const std::vector<sasi::InputEvent>& sasi::InputReplay::getEvents() const
+{
+    return m_events;
+}
+
+int sasi::InputReplay::applyEventsForStep(uint64_t step, ParticleSimulator& simulator)
+{
+    int applied = 0;
+    while ((m_nextEvent < m_events.size()) && (m_events[m_nextEvent].step <= step))
+    {
+        applyInputEvent(simulator, m_events[m_nextEvent]);
+        ++m_nextEvent;
+        ++applied;
+    }
+    return applied;
+}
+
+bool sasi::InputReplay::isFinished() const
+{
+    return m_nextEvent >= m_events.size();
+}
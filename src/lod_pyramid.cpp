@@ -0,0 +1,123 @@
+#include "lod_pyramid.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+    // Averages each 8-bit channel of four colours, rounding down, without unpacking them. The
+    // top six bits of every channel are summed apart from the bottom two so no sum carries into
+    // the next channel.
+    uint32_t averageColors(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+    {
+        const uint32_t high = ((a >> 2) & 0x3F3F3F3Fu) + ((b >> 2) & 0x3F3F3F3Fu)
+            + ((c >> 2) & 0x3F3F3F3Fu) + ((d >> 2) & 0x3F3F3F3Fu);
+        const uint32_t low = (a & 0x03030303u) + (b & 0x03030303u) + (c & 0x03030303u) + (d & 0x03030303u);
+        return high + ((low >> 2) & 0x03030303u);
+    }
+
+    sasi::ParticleType firstNonVoid(sasi::ParticleType a, sasi::ParticleType b, sasi::ParticleType c, sasi::ParticleType d)
+    {
+        const sasi::ParticleType empty = sasi::ParticleType::Void;
+        return (a != empty) ? a : ((b != empty) ? b : ((c != empty) ? c : d));
+    }
+}
+
+sasi::LodPyramid::LodPyramid(int width, int height, int levelCount)
+    : m_levels()
+{
+    assert(levelCount >= 1);
+
+    m_levels.resize(static_cast<size_t>(levelCount));
+    m_levels[0].width = width;
+    m_levels[0].height = height;
+    for (int level = 1; level < levelCount; ++level)
+    {
+        Level& current = m_levels[level];
+        current.width = std::max((m_levels[level - 1].width + 1) / 2, 1);
+        current.height = std::max((m_levels[level - 1].height + 1) / 2, 1);
+
+        const size_t cellCount = static_cast<size_t>(current.width) * current.height;
+        current.colors.reset(new uint32_t[cellCount]());
+        current.types.reset(new ParticleType[cellCount]());
+    }
+}
+
+int sasi::LodPyramid::getLevelCount() const
+{
+    return static_cast<int>(m_levels.size());
+}
+
+int sasi::LodPyramid::getLevelWidth(int level) const
+{
+    return m_levels[level].width;
+}
+
+int sasi::LodPyramid::getLevelHeight(int level) const
+{
+    return m_levels[level].height;
+}
+
+const uint32_t* sasi::LodPyramid::getColors(int level) const
+{
+    assert(level > 0);
+    return m_levels[level].colors.get();
+}
+
+const sasi::ParticleType* sasi::LodPyramid::getTypes(int level) const
+{
+    assert(level > 0);
+    return m_levels[level].types.get();
+}
+
+void sasi::LodPyramid::update(const uint32_t* colors, const ParticleType* types, int stride, const DirtyRect& rect)
+{
+    if (rect.isEmpty())
+    {
+        return;
+    }
+
+    // Each level is rebuilt from the one below, starting from the caller's planes.
+    const uint32_t* sourceColors = colors;
+    const ParticleType* sourceTypes = types;
+    int sourceStride = stride;
+    for (int level = 1; level < getLevelCount(); ++level)
+    {
+        const Level& source = m_levels[level - 1];
+        Level& target = m_levels[level];
+        const DirtyRect region = toLevel(rect, level);
+        const int maxX = std::min(region.maxX, target.width - 1);
+        const int maxY = std::min(region.maxY, target.height - 1);
+        for (int y = region.minY; y <= maxY; ++y)
+        {
+            // Odd sizes repeat the last row and column below.
+            const size_t topRow = static_cast<size_t>(y * 2) * sourceStride;
+            const size_t bottomRow = static_cast<size_t>(std::min((y * 2) + 1, source.height - 1)) * sourceStride;
+            const size_t targetRow = static_cast<size_t>(y) * target.width;
+            for (int x = region.minX; x <= maxX; ++x)
+            {
+                const size_t left = static_cast<size_t>(x * 2);
+                const size_t right = static_cast<size_t>(std::min((x * 2) + 1, source.width - 1));
+                target.colors[targetRow + x] = averageColors(
+                    sourceColors[topRow + left], sourceColors[topRow + right],
+                    sourceColors[bottomRow + left], sourceColors[bottomRow + right]);
+                target.types[targetRow + x] = firstNonVoid(
+                    sourceTypes[topRow + left], sourceTypes[topRow + right],
+                    sourceTypes[bottomRow + left], sourceTypes[bottomRow + right]);
+            }
+        }
+
+        sourceColors = target.colors.get();
+        sourceTypes = target.types.get();
+        sourceStride = target.width;
+    }
+}
+
+sasi::DirtyRect sasi::LodPyramid::toLevel(const DirtyRect& rect, int level)
+{
+    if (rect.isEmpty())
+    {
+        return rect;
+    }
+    return DirtyRect{ rect.minX >> level, rect.minY >> level, rect.maxX >> level, rect.maxY >> level };
+}
@@ -0,0 +1,249 @@
+#include "log.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+    // The queue holds this many messages, a power of two so positions wrap with a mask.
+    const uint64_t k_slotCount = 512u;
+    static_assert((k_slotCount & (k_slotCount - 1u)) == 0u, "Log slot count must be a power of two.");
+
+    // Longer messages are cut short.
+    const size_t k_maxMessageLength = 256u;
+
+    // Each site gets this many messages through per window.
+    const uint32_t k_messagesPerWindow = 5u;
+    const int64_t k_windowMs = 1000;
+
+    // How long the logging thread sleeps when nothing wakes it.
+    const std::chrono::milliseconds k_drainInterval{ 10 };
+
+    const char* getPrefix(sasi::LogLevel level)
+    {
+        switch (level)
+        {
+        case sasi::LogLevel::Debug:
+            return "SASI (DEBUG): ";
+        case sasi::LogLevel::Info:
+            return "SASI (INFO): ";
+        case sasi::LogLevel::Warning:
+            return "SASI (WARNING): ";
+        case sasi::LogLevel::Error:
+            return "SASI (ERROR): ";
+        }
+        return "SASI: ";
+    }
+
+    // A bounded queue in the style of Dmitry Vyukov's: each slot's sequence says whether it is
+    // free for the producer at a position or holds a message for the consumer, so producers
+    // only contend on one compare-exchange and the consumer on none.
+    class Logger
+    {
+    public:
+        static Logger& get()
+        {
+            static Logger logger;
+            return logger;
+        }
+
+        // Queues a message. Returns false, counting it as dropped, when the queue is full.
+        bool push(sasi::LogLevel level, const char* text)
+        {
+            uint64_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+            Slot* slot = nullptr;
+            while (true)
+            {
+                slot = &m_slots[position & (k_slotCount - 1u)];
+                const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+                const int64_t difference = static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+                if (difference == 0)
+                {
+                    if (m_enqueuePosition.compare_exchange_weak(position, position + 1u, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    m_droppedCount.fetch_add(1u, std::memory_order_relaxed);
+                    return false;
+                }
+                else
+                {
+                    position = m_enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->level = level;
+            std::snprintf(slot->text, sizeof(slot->text), "%s", text);
+            slot->sequence.store(position + 1u, std::memory_order_release);
+
+            // Errors are worth writing straight away, the rest can wait for the next drain.
+            if (level == sasi::LogLevel::Error)
+            {
+                m_wake.notify_one();
+            }
+            return true;
+        }
+
+        void flush()
+        {
+            const uint64_t target = m_enqueuePosition.load(std::memory_order_acquire);
+            while (m_dequeuePosition.load(std::memory_order_acquire) < target)
+            {
+                m_wake.notify_one();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        std::atomic<uint8_t> minLevel;
+
+    private:
+        struct Slot
+        {
+            std::atomic<uint64_t> sequence;
+            sasi::LogLevel level;
+            char text[k_maxMessageLength];
+        };
+
+        Logger()
+            : minLevel(static_cast<uint8_t>(sasi::LogLevel::Info))
+            , m_enqueuePosition(0u)
+            , m_dequeuePosition(0u)
+            , m_droppedCount(0u)
+            , m_isQuitting(false)
+        {
+            for (uint64_t i = 0u; i < k_slotCount; ++i)
+            {
+                m_slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            m_thread = std::thread(&Logger::drainLoop, this);
+        }
+
+        ~Logger()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_isQuitting = true;
+            }
+            m_wake.notify_one();
+            m_thread.join();
+        }
+
+        void drainLoop()
+        {
+            while (true)
+            {
+                bool isQuitting = false;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wake.wait_for(lock, k_drainInterval);
+                    isQuitting = m_isQuitting;
+                }
+
+                drain();
+                if (isQuitting)
+                {
+                    return;
+                }
+            }
+        }
+
+        void drain()
+        {
+            bool hasWritten = false;
+            while (true)
+            {
+                const uint64_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+                Slot& slot = m_slots[position & (k_slotCount - 1u)];
+                if (slot.sequence.load(std::memory_order_acquire) != position + 1u)
+                {
+                    break;
+                }
+
+                std::cout << getPrefix(slot.level) << slot.text << "\n";
+                slot.sequence.store(position + k_slotCount, std::memory_order_release);
+                m_dequeuePosition.store(position + 1u, std::memory_order_release);
+                hasWritten = true;
+            }
+
+            const uint64_t droppedCount = m_droppedCount.exchange(0u, std::memory_order_relaxed);
+            if (droppedCount > 0u)
+            {
+                std::cout << getPrefix(sasi::LogLevel::Warning) << droppedCount << " log messages dropped, the log queue was full\n";
+                hasWritten = true;
+            }
+
+            if (hasWritten)
+            {
+                std::cout.flush();
+            }
+        }
+
+    private:
+        Slot m_slots[k_slotCount];
+        std::atomic<uint64_t> m_enqueuePosition;
+        std::atomic<uint64_t> m_dequeuePosition;
+        std::atomic<uint64_t> m_droppedCount;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        bool m_isQuitting;
+        std::thread m_thread;
+    };
+}
+
+void sasi::logMessage(LogSite& site, LogLevel level, const char* format, ...)
+{
+    Logger& logger = Logger::get();
+    if (static_cast<uint8_t>(level) < logger.minLevel.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    // Start a new window once the last one is over. Should two threads race here, one of them
+    // resets the count and the other carries on in the new window.
+    const int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t windowStartMs = site.windowStartMs.load(std::memory_order_relaxed);
+    if ((nowMs - windowStartMs >= k_windowMs)
+        && site.windowStartMs.compare_exchange_strong(windowStartMs, nowMs, std::memory_order_relaxed))
+    {
+        site.windowCount.store(0u, std::memory_order_relaxed);
+    }
+    if (site.windowCount.fetch_add(1u, std::memory_order_relaxed) >= k_messagesPerWindow)
+    {
+        site.suppressedCount.fetch_add(1u, std::memory_order_relaxed);
+        return;
+    }
+
+    char text[k_maxMessageLength];
+    va_list arguments;
+    va_start(arguments, format);
+    int length = std::vsnprintf(text, sizeof(text), format, arguments);
+    va_end(arguments);
+
+    const uint32_t suppressedCount = site.suppressedCount.exchange(0u, std::memory_order_relaxed);
+    if ((suppressedCount > 0u) && (length >= 0) && (static_cast<size_t>(length) < sizeof(text)))
+    {
+        std::snprintf(text + length, sizeof(text) - length, " (%u more like this suppressed)", suppressedCount);
+    }
+
+    logger.push(level, text);
+}
+
+void sasi::setLogLevel(LogLevel level)
+{
+    Logger::get().minLevel.store(static_cast<uint8_t>(level), std::memory_order_relaxed);
+}
+
+void sasi::flushLog()
+{
+    Logger::get().flush();
+}
@@ -1,10 +1,27 @@
+#include <cstdlib>
+#include <cstring>
 #include <memory>
 
 #include "engine/engine.h"
 
 int main(int argc, char* argv[])
 {
-    std::unique_ptr<sasi::Engine> engine{ new sasi::Engine{ 600, 400 } };
+    // The world's size is needed to make the engine, everything else is applied to it after.
+    int worldWidth = 160;
+    int worldHeight = 160;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--world-width") == 0)
+        {
+            worldWidth = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--world-height") == 0)
+        {
+            worldHeight = std::atoi(argv[++i]);
+        }
+    }
+
+    std::unique_ptr<sasi::Engine> engine{ new sasi::Engine{ 600, 400, worldWidth, worldHeight } };
     if (engine.get() == nullptr)
     {
         return -1;
@@ -14,6 +31,44 @@ int main(int argc, char* argv[])
         return -1;
     }
 
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--metrics-csv") == 0)
+        {
+            engine->openMetricsCsv(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--load") == 0)
+        {
+            engine->loadSnapshot(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--stream") == 0)
+        {
+            engine->enableStreaming(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--materials") == 0)
+        {
+            if (!engine->loadMaterials(argv[++i]))
+            {
+                return -1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--record") == 0)
+        {
+            engine->startRecording(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--replay") == 0)
+        {
+            if (!engine->startReplay(argv[++i]))
+            {
+                return -1;
+            }
+        }
+        else if ((std::strcmp(argv[i], "--world-width") == 0) || (std::strcmp(argv[i], "--world-height") == 0))
+        {
+            ++i;
+        }
+    }
+
     bool exit = false;
     while (!exit)
     {
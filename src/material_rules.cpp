@@ -0,0 +1,388 @@
+#include "material_rules.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "log.h"
+#include "particle_simulator.h"
+
+namespace
+{
+    // FNV-1a, fed little endian whatever the host.
+    void hashBytes(uint64_t& hash, uint64_t value, int byteCount)
+    {
+        for (int i = 0; i < byteCount; ++i)
+        {
+            hash = (hash ^ ((value >> (i * 8)) & 0xFFu)) * 1099511628211ull;
+        }
+    }
+
+    bool parseInt(const std::string& token, int& outValue)
+    {
+        char* end = nullptr;
+        const long value = std::strtol(token.c_str(), &end, 10);
+        if (token.empty() || (*end != '\0'))
+        {
+            return false;
+        }
+
+        outValue = static_cast<int>(value);
+        return true;
+    }
+
+    bool parseColor(const std::string& token, uint32_t& outColor)
+    {
+        char* end = nullptr;
+        const unsigned long value = std::strtoul(token.c_str(), &end, 16);
+        if ((token.size() != 8) || (*end != '\0'))
+        {
+            return false;
+        }
+
+        outColor = static_cast<uint32_t>(value);
+        return true;
+    }
+
+    bool parseRuleKind(const std::string& token, sasi::MaterialRuleKind& outKind)
+    {
+        if (token == "move")
+        {
+            outKind = sasi::MaterialRuleKind::Move;
+        }
+        else if (token == "sink")
+        {
+            outKind = sasi::MaterialRuleKind::Sink;
+        }
+        else if (token == "float")
+        {
+            outKind = sasi::MaterialRuleKind::Float;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    // Parses the rest of a rule line, after its kind.
+    bool parseRule(std::istringstream& line, sasi::MaterialRule& outRule, std::string& outError)
+    {
+        std::vector<std::string> tokens;
+        for (std::string token; line >> token;)
+        {
+            tokens.push_back(token);
+        }
+
+        size_t next = 0u;
+        if ((next < tokens.size()) && (tokens[next] == "random"))
+        {
+            outRule.isRandom = true;
+            ++next;
+        }
+
+        if ((next == tokens.size()) || (((tokens.size() - next) % 2u) != 0u))
+        {
+            outError = "a rule needs dx dy pairs";
+            return false;
+        }
+
+        for (; next < tokens.size(); next += 2u)
+        {
+            sasi::MaterialOffset offset{};
+            if (!parseInt(tokens[next], offset.dx) || !parseInt(tokens[next + 1u], offset.dy))
+            {
+                outError = "offsets must be whole numbers";
+                return false;
+            }
+
+            const int reach = sasi::ParticleSimulator::k_tickReach;
+            if ((std::abs(offset.dx) > reach) || (std::abs(offset.dy) > reach) || ((offset.dx == 0) && (offset.dy == 0)))
+            {
+                outError = "offsets must reach a neighbour within the tick reach";
+                return false;
+            }
+            outRule.offsets.push_back(offset);
+        }
+
+        if (static_cast<int>(outRule.offsets.size()) > sasi::CompiledRule::k_maxOffsets)
+        {
+            outError = "a rule has too many offsets";
+            return false;
+        }
+        return true;
+    }
+}
+
+bool sasi::parseMaterialDefinitions(const std::string& text, const std::string& sourceName, std::vector<MaterialDefinition>& outDefinitions)
+{
+    std::vector<MaterialDefinition> definitions;
+    std::istringstream lines(text);
+    std::string lineText;
+    int lineNumber = 0;
+    while (std::getline(lines, lineText))
+    {
+        ++lineNumber;
+        const size_t comment = lineText.find('#');
+        if (comment != std::string::npos)
+        {
+            lineText.resize(comment);
+        }
+
+        std::istringstream line(lineText);
+        std::string keyword;
+        if (!(line >> keyword))
+        {
+            continue;
+        }
+
+        std::string value;
+        std::string error;
+        MaterialRuleKind kind = MaterialRuleKind::Move;
+        if (keyword == "material")
+        {
+            if (!(line >> value))
+            {
+                error = "a material needs a name";
+            }
+            else
+            {
+                for (const MaterialDefinition& definition : definitions)
+                {
+                    if (definition.name == value)
+                    {
+                        error = "material " + value + " is defined twice";
+                    }
+                }
+                definitions.emplace_back();
+                definitions.back().name = value;
+            }
+        }
+        else if (definitions.empty())
+        {
+            error = "expected a material line first";
+        }
+        else if (keyword == "color")
+        {
+            if (!(line >> value) || !parseColor(value, definitions.back().color))
+            {
+                error = "colours are 8 hex digits, AABBGGRR";
+            }
+        }
+        else if (keyword == "density")
+        {
+            if (!(line >> value) || !parseInt(value, definitions.back().density))
+            {
+                error = "density must be a whole number";
+            }
+        }
+        else if (keyword == "fluid")
+        {
+            definitions.back().isFluid = true;
+        }
+        else if (parseRuleKind(keyword, kind))
+        {
+            MaterialRule rule;
+            rule.kind = kind;
+            if (parseRule(line, rule, error))
+            {
+                definitions.back().rules.push_back(rule);
+                if (static_cast<int>(definitions.back().rules.size()) > MaterialTable::k_maxRules)
+                {
+                    error = "material " + definitions.back().name + " has too many rules";
+                }
+            }
+        }
+        else
+        {
+            error = "unknown keyword " + keyword;
+        }
+
+        if (!error.empty())
+        {
+            SASI_LOG_ERROR("%s:%d: %s", sourceName.c_str(), lineNumber, error.c_str());
+            return false;
+        }
+    }
+
+    outDefinitions.insert(outDefinitions.end(), definitions.begin(), definitions.end());
+    return true;
+}
+
+bool sasi::loadMaterialDefinitions(const std::string& path, std::vector<MaterialDefinition>& outDefinitions)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        SASI_LOG_ERROR("failed to open material definitions %s", path.c_str());
+        return false;
+    }
+
+    std::ostringstream text;
+    text << file.rdbuf();
+    return parseMaterialDefinitions(text.str(), path, outDefinitions);
+}
+
+sasi::MaterialTable::MaterialTable()
+    : m_isDefined({})
+    , m_colors({})
+    , m_densities({})
+    , m_isFluid({})
+    , m_firstRules({})
+    , m_ruleCounts({})
+    , m_rules({})
+    , m_actionTables({})
+    , m_definedTypes({})
+    , m_definitions({})
+{
+    // Built-in types keep their hand-written kernels, but materials still need to know what
+    // they can sink or float through.
+    m_densities[static_cast<uint8_t>(ParticleType::Sand)] = 1600;
+    m_densities[static_cast<uint8_t>(ParticleType::Water)] = 1000;
+    m_isFluid[static_cast<uint8_t>(ParticleType::Water)] = true;
+}
+
+bool sasi::MaterialTable::define(ParticleType type, const MaterialDefinition& definition)
+{
+    const size_t ruleCount = m_rules.size() + definition.rules.size();
+    if ((definition.rules.size() > static_cast<size_t>(k_maxRules)) || (ruleCount > UINT16_MAX) || isDefined(type))
+    {
+        return false;
+    }
+    for (const MaterialRule& rule : definition.rules)
+    {
+        if (rule.offsets.empty() || (rule.offsets.size() > static_cast<size_t>(CompiledRule::k_maxOffsets)))
+        {
+            return false;
+        }
+    }
+
+    const uint8_t index = static_cast<uint8_t>(type);
+    m_isDefined[index] = true;
+    m_colors[index] = definition.color;
+    m_densities[index] = definition.density;
+    m_isFluid[index] = definition.isFluid;
+    m_definedTypes.push_back(type);
+    m_definitions.push_back(definition);
+
+    compile();
+    return true;
+}
+
+sasi::ParticleType sasi::MaterialTable::findType(const std::string& name) const
+{
+    for (size_t i = 0; i < m_definitions.size(); ++i)
+    {
+        if (m_definitions[i].name == name)
+        {
+            return m_definedTypes[i];
+        }
+    }
+    return ParticleType::Max;
+}
+
+const std::vector<sasi::MaterialDefinition>& sasi::MaterialTable::getDefinitions() const
+{
+    return m_definitions;
+}
+
+uint64_t sasi::MaterialTable::getDigest() const
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < m_definitions.size(); ++i)
+    {
+        const MaterialDefinition& definition = m_definitions[i];
+        hashBytes(hash, static_cast<uint8_t>(m_definedTypes[i]), 1);
+        hashBytes(hash, definition.name.size(), 4);
+        for (const char c : definition.name)
+        {
+            hashBytes(hash, static_cast<uint8_t>(c), 1);
+        }
+        hashBytes(hash, definition.color, 4);
+        hashBytes(hash, static_cast<uint32_t>(definition.density), 4);
+        hashBytes(hash, definition.isFluid ? 1u : 0u, 1);
+        hashBytes(hash, definition.rules.size(), 1);
+        for (const MaterialRule& rule : definition.rules)
+        {
+            hashBytes(hash, static_cast<uint8_t>(rule.kind), 1);
+            hashBytes(hash, rule.isRandom ? 1u : 0u, 1);
+            hashBytes(hash, rule.offsets.size(), 1);
+            for (const MaterialOffset& offset : rule.offsets)
+            {
+                hashBytes(hash, static_cast<uint32_t>(offset.dx), 4);
+                hashBytes(hash, static_cast<uint32_t>(offset.dy), 4);
+            }
+        }
+    }
+    return hash;
+}
+
+void sasi::MaterialTable::compile()
+{
+    m_rules.clear();
+    m_actionTables.clear();
+
+    // Action tables only depend on the rule kind and the density of the material following
+    // it, so rules sharing both share a table.
+    struct TableKey
+    {
+        MaterialRuleKind kind;
+        int density;
+    };
+    std::vector<TableKey> tableKeys;
+
+    for (size_t i = 0; i < m_definitions.size(); ++i)
+    {
+        const MaterialDefinition& definition = m_definitions[i];
+        const uint8_t typeIndex = static_cast<uint8_t>(m_definedTypes[i]);
+        m_firstRules[typeIndex] = static_cast<uint16_t>(m_rules.size());
+        m_ruleCounts[typeIndex] = static_cast<uint8_t>(definition.rules.size());
+
+        for (const MaterialRule& rule : definition.rules)
+        {
+            CompiledRule compiled{};
+            compiled.offsetCount = static_cast<uint8_t>(rule.offsets.size());
+            compiled.isRandom = rule.isRandom;
+            for (size_t offset = 0; offset < rule.offsets.size(); ++offset)
+            {
+                compiled.dx[offset] = static_cast<int8_t>(rule.offsets[offset].dx);
+                compiled.dy[offset] = static_cast<int8_t>(rule.offsets[offset].dy);
+            }
+
+            size_t table = 0u;
+            while ((table < tableKeys.size()) && ((tableKeys[table].kind != rule.kind) || (tableKeys[table].density != definition.density)))
+            {
+                ++table;
+            }
+            if (table == tableKeys.size())
+            {
+                tableKeys.push_back(TableKey{ rule.kind, definition.density });
+
+                std::array<RuleAction, k_maxTypes> actions{};
+                for (int target = 0; target < k_maxTypes; ++target)
+                {
+                    const bool isLighterFluid = m_isFluid[target] && (m_densities[target] < definition.density);
+                    const bool isHeavierFluid = m_isFluid[target] && (m_densities[target] > definition.density);
+                    switch (rule.kind)
+                    {
+                    case MaterialRuleKind::Move:
+                        actions[target] = (target == static_cast<int>(ParticleType::Void)) ? RuleAction::Move : RuleAction::None;
+                        break;
+                    case MaterialRuleKind::Sink:
+                        actions[target] = (target == static_cast<int>(ParticleType::Void)) ? RuleAction::Move
+                            : (isLighterFluid ? RuleAction::Swap : RuleAction::None);
+                        break;
+                    case MaterialRuleKind::Float:
+                        actions[target] = isHeavierFluid ? RuleAction::Swap : RuleAction::None;
+                        break;
+                    }
+                }
+                m_actionTables.push_back(actions);
+            }
+            compiled.actionTable = static_cast<uint16_t>(table);
+
+            m_rules.push_back(compiled);
+        }
+    }
+}
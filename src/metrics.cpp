@@ -0,0 +1,120 @@
+#include "metrics.h"
+
+#include <algorithm>
+
+#include "log.h"
+
+namespace
+{
+    double percentile(const std::vector<double>& sorted, double fraction)
+    {
+        const size_t rank = static_cast<size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[rank];
+    }
+}
+
+sasi::RollingWindow::RollingWindow(size_t capacity)
+    : m_capacity(std::max(capacity, static_cast<size_t>(1)))
+    , m_next(0)
+{
+    m_samples.reserve(m_capacity);
+}
+
+void sasi::RollingWindow::add(double sample)
+{
+    if (m_samples.size() < m_capacity)
+    {
+        m_samples.push_back(sample);
+        return;
+    }
+
+    m_samples[m_next] = sample;
+    m_next = (m_next + 1) % m_capacity;
+}
+
+sasi::MetricSummary sasi::RollingWindow::summarize(std::vector<double>& scratch) const
+{
+    MetricSummary summary;
+    if (m_samples.empty())
+    {
+        return summary;
+    }
+
+    // The windows are small, a sort per summary costs less than keeping them ordered.
+    scratch.assign(m_samples.begin(), m_samples.end());
+    std::sort(scratch.begin(), scratch.end());
+    summary.p50 = percentile(scratch, 0.5);
+    summary.p99 = percentile(scratch, 0.99);
+    summary.max = scratch.back();
+    return summary;
+}
+
+sasi::MetricsRecorder::MetricsRecorder(size_t windowSize)
+    : m_tickMs(windowSize)
+    , m_colorMs(windowSize)
+    , m_particlesTicked(windowSize)
+    , m_particlesMoved(windowSize)
+    , m_activeChunks(windowSize)
+    , m_stepsPerUpdate(windowSize)
+    , m_stepCount(0ull)
+    , m_updateCount(0ull)
+{
+}
+
+bool sasi::MetricsRecorder::openCsv(const std::string& path)
+{
+    m_csv.close();
+    m_csv.open(path, std::ios::out | std::ios::trunc);
+    if (!m_csv.is_open())
+    {
+        SASI_LOG_ERROR("failed to open metrics file %s", path.c_str());
+        return false;
+    }
+
+    m_csv << "step,update,tick_ms,color_ms,particles_ticked,particles_moved,active_chunks\n";
+    return true;
+}
+
+void sasi::MetricsRecorder::recordStep(const StepMetrics& metrics)
+{
+    const double tickMs = metrics.tickSecs * 1000.0;
+    const double colorMs = metrics.colorSecs * 1000.0;
+    m_tickMs.add(tickMs);
+    m_colorMs.add(colorMs);
+    m_particlesTicked.add(metrics.particlesTicked);
+    m_particlesMoved.add(metrics.particlesMoved);
+    m_activeChunks.add(metrics.activeChunks);
+
+    if (m_csv.is_open())
+    {
+        m_csv
+            << m_stepCount << ','
+            << m_updateCount << ','
+            << tickMs << ','
+            << colorMs << ','
+            << metrics.particlesTicked << ','
+            << metrics.particlesMoved << ','
+            << metrics.activeChunks << '\n';
+    }
+
+    ++m_stepCount;
+}
+
+void sasi::MetricsRecorder::recordUpdate(int stepsRun)
+{
+    m_stepsPerUpdate.add(stepsRun);
+    ++m_updateCount;
+}
+
+sasi::MetricsSummary sasi::MetricsRecorder::summarize()
+{
+    MetricsSummary summary;
+    summary.tickMs = m_tickMs.summarize(m_scratch);
+    summary.colorMs = m_colorMs.summarize(m_scratch);
+    summary.particlesTicked = m_particlesTicked.summarize(m_scratch);
+    summary.particlesMoved = m_particlesMoved.summarize(m_scratch);
+    summary.activeChunks = m_activeChunks.summarize(m_scratch);
+    summary.stepsPerUpdate = m_stepsPerUpdate.summarize(m_scratch);
+    summary.stepCount = m_stepCount;
+    return summary;
+}
@@ -6,29 +6,45 @@
 sasi::ParticleRegistry::ParticleRegistry()
     : m_tickFunctions({})
     , m_makeFunctions({})
+    , m_materials()
+    , m_nextCustomType(static_cast<int>(k_firstCustomType))
 {
-    m_tickFunctions.insert({ ParticleType::Sand, sandTick });
-    m_makeFunctions.insert({ ParticleType::Sand, sandMake });
-    m_tickFunctions.insert({ ParticleType::Water, waterTick });
-    m_makeFunctions.insert({ ParticleType::Water, waterMake });
+    registerBuiltIn<ParticleType::Sand>();
+    registerBuiltIn<ParticleType::Water>();
 }
 
-sasi::TickFunction sasi::ParticleRegistry::getTickFunction(ParticleType type) const
+sasi::ParticleType sasi::ParticleRegistry::registerParticle(TickFunction tickFunction, MakeFunction makeFunction)
 {
-    if (auto it = m_tickFunctions.find(type); it != m_tickFunctions.end())
+    // Max is reserved as the invalid type.
+    if (m_nextCustomType >= static_cast<int>(ParticleType::Max))
     {
-        return it->second;
+        return ParticleType::Max;
     }
 
-    return nullptr;
+    const int type = m_nextCustomType++;
+    m_tickFunctions[type] = tickFunction;
+    m_makeFunctions[type] = makeFunction;
+    return static_cast<ParticleType>(type);
 }
 
-sasi::MakeFunction sasi::ParticleRegistry::getMakeFunction(ParticleType type) const
+sasi::ParticleType sasi::ParticleRegistry::registerMaterial(const MaterialDefinition& definition)
 {
-    if (auto it = m_makeFunctions.find(type); it != m_makeFunctions.end())
+    if (m_nextCustomType >= static_cast<int>(ParticleType::Max))
     {
-        return it->second;
+        return ParticleType::Max;
     }
 
-    return nullptr;
+    const ParticleType type = static_cast<ParticleType>(m_nextCustomType);
+    if (!m_materials.define(type, definition))
+    {
+        return ParticleType::Max;
+    }
+
+    ++m_nextCustomType;
+    return type;
+}
+
+bool sasi::ParticleRegistry::isRegistered(ParticleType type) const
+{
+    return (getTickFunction(type) != nullptr) || (getMakeFunction(type) != nullptr) || m_materials.isDefined(type);
 }
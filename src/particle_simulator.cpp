@@ -1,73 +1,306 @@
 #include "particle_simulator.h"
 
-#include "sasi.h"
+#include "sasi_core.h"
 
 #include <algorithm>
-#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <chrono>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "log.h"
 #include "particle_registry.h"
 #include "particle.h"
+#include "row_kernel.h"
+#include "thread_pool.h"
+
+#include "particle/material.h"
+#include "particle/sand.h"
+#include "particle/water.h"
+
+namespace
+{
+    // Classes of cell in a Margolus block, heaviest movable class last.
+    enum BlockClass : uint8_t
+    {
+        k_blockEmpty = 0,
+        k_blockLiquid = 1,
+        k_blockPowder = 2,
+        k_blockWall = 3,
+    };
+
+    // The rule for a block of cells left unchanged, each taken from where it already is.
+    const uint8_t k_identityBlockRule = 0 | (1 << 2) | (2 << 4) | (3 << 6);
 
-sasi::ParticleSimulator::ParticleSimulator(int width, int height)
+    // Works out where the cells of every block state end up. Cells are numbered top left, top
+    // right, bottom left, bottom right. In order: movable cells fall into lighter cells below,
+    // cells that could not fall slide diagonally into lighter cells, and liquids that have not
+    // moved spread sideways into empty cells. Walls never move.
+    void buildBlockRules(std::array<uint8_t, 256>& outRules)
+    {
+        for (int state = 0; state < 256; ++state)
+        {
+            uint8_t classes[4];
+            uint8_t sources[4] = { 0, 1, 2, 3 };
+            bool moved[4] = { false, false, false, false };
+            for (int cell = 0; cell < 4; ++cell)
+            {
+                classes[cell] = static_cast<uint8_t>((state >> (cell * 2)) & 3);
+            }
+
+            auto exchange = [&](int a, int b)
+            {
+                std::swap(classes[a], classes[b]);
+                std::swap(sources[a], sources[b]);
+                moved[a] = true;
+                moved[b] = true;
+            };
+            auto canDisplace = [&](int from, int to)
+            {
+                return (classes[from] != k_blockWall) && (classes[to] != k_blockWall) && (classes[from] > classes[to]);
+            };
+
+            for (int column = 0; column < 2; ++column)
+            {
+                if (canDisplace(column, column + 2))
+                {
+                    exchange(column, column + 2);
+                }
+            }
+
+            for (int column = 0; column < 2; ++column)
+            {
+                const int diagonal = (1 - column) + 2;
+                if (!moved[column] && canDisplace(column, diagonal))
+                {
+                    exchange(column, diagonal);
+                }
+            }
+
+            for (int row = 0; row < 4; row += 2)
+            {
+                const int left = row;
+                const int right = row + 1;
+                if (moved[left] || moved[right])
+                {
+                    continue;
+                }
+                if (((classes[left] == k_blockLiquid) && (classes[right] == k_blockEmpty))
+                    || ((classes[left] == k_blockEmpty) && (classes[right] == k_blockLiquid)))
+                {
+                    exchange(left, right);
+                }
+            }
+
+            outRules[state] = static_cast<uint8_t>(sources[0] | (sources[1] << 2) | (sources[2] << 4) | (sources[3] << 6));
+        }
+    }
+}
+
+sasi::ParticleSimulator::ParticleSimulator(int width, int height, const SimulatorOptions& options)
     : m_width(width)
     , m_height(height)
     , m_dataSize(width * height)
+    , m_stride(width + (k_ghostCells * 2))
+    , m_planeSize(m_stride * (height + (k_ghostCells * 2)))
+    , m_worldOriginX(0)
+    , m_worldOriginY(0)
+    , m_chunkCountX((width + k_chunkSize - 1) / k_chunkSize)
+    , m_chunkCountY((height + k_chunkSize - 1) / k_chunkSize)
+    , m_chunks(new Chunk[m_chunkCountX * m_chunkCountY])
+    , m_awakeChunkColumns(new int[m_chunkCountX])
+    , m_phaseChunks({})
+    , m_dirtyRectScratch({})
+    , m_brushSpans({})
+    , m_brushMinY(0)
+    , m_threadPool(options.threadCount > 1 ? new ThreadPool(options.threadCount) : nullptr)
+    , m_useRowKernels(options.useRowKernels)
+    , m_backend(options.backend)
+    , m_blockClasses({})
+    , m_blockRules({})
+    , m_isColorOutputEnabled(true)
     , m_simulationStep(0ull)
+    , m_randomSeed(options.randomSeed)
+    , m_random(options.randomSeed, 0ull)
+    , m_lastStepMetrics({})
     , m_particleRegistry(new ParticleRegistry())
-    , m_particleData(new Particle[m_dataSize])
+    , m_types(new ParticleType[m_planeSize + k_chunkSize])
+    , m_colors(new uint32_t[m_planeSize])
+    , m_updatedMasks(new UpdatedMask[m_chunkCountX * m_chunkCountY])
     , m_colorData(new uint32_t[m_dataSize])
+    , m_velocityOptions(options.velocity)
+    , m_velocities(nullptr)
     , m_particleOutOfBounds({ ParticleType::OutOfBounds, 0x00000000 })
     , m_particleVoid({ ParticleType::Void, 0xFF0F0F0F })
 {
-    std::fill_n(m_particleData.get(), m_dataSize, m_particleVoid);
-    std::fill_n(m_colorData.get(), m_dataSize, 0xFF000000);
+    // Everything starts out of bounds and the grid inside the ghost border is then emptied.
+    std::fill_n(m_types.get(), m_planeSize + k_chunkSize, m_particleOutOfBounds.type);
+    std::fill_n(m_colors.get(), m_planeSize, m_particleOutOfBounds.color);
+    for (int y = 0; y < m_height; ++y)
+    {
+        std::fill_n(&m_types[cellIndex(0, y)], m_width, m_particleVoid.type);
+        std::fill_n(&m_colors[cellIndex(0, y)], m_width, m_particleVoid.color);
+    }
+    for (int i = 0; i < m_chunkCountX * m_chunkCountY; ++i)
+    {
+        clearUpdatedMask(i);
+    }
+    std::fill_n(m_colorData.get(), m_dataSize, m_particleVoid.color);
+
+    m_blockClasses.fill(k_blockWall);
+    m_blockClasses[static_cast<uint8_t>(ParticleType::Void)] = k_blockEmpty;
+    m_blockClasses[static_cast<uint8_t>(ParticleType::Water)] = k_blockLiquid;
+    m_blockClasses[static_cast<uint8_t>(ParticleType::Sand)] = k_blockPowder;
+    buildBlockRules(m_blockRules);
+
+    m_velocityOptions.enabled = m_velocityOptions.enabled && (m_backend == SimulationBackend::CellScan);
+    if (m_velocityOptions.enabled)
+    {
+        m_velocities.reset(new Velocity[m_planeSize]);
+        m_useRowKernels = false;
+    }
+}
+
+sasi::ParticleSimulator::~ParticleSimulator()
+{
 }
 
 void sasi::ParticleSimulator::tick(double fixedDeltaTime)
 {
     if (m_particleRegistry.get() == nullptr)
     {
-        std::cout << "SASI (ERROR): missing particle registry on particle simulator.\n";
+        SASI_LOG_ERROR("missing particle registry on particle simulator.");
         return;
     }
 
-    using std::chrono::high_resolution_clock;
-    using std::chrono::duration_cast;
+    using std::chrono::steady_clock;
     using std::chrono::duration;
-    using std::chrono::milliseconds;
-    auto t1 = high_resolution_clock::now();
+    const auto tickStart = steady_clock::now();
 
-    // Invoke the tick function for each particle.
-    for (int i = 0; i < m_dataSize; ++i)
+    // Promote the cells touched during the last step, or edited since, to this step's work.
+    const int chunkCount = m_chunkCountX * m_chunkCountY;
+    uint32_t activeChunks = 0u;
+    for (int i = 0; i < chunkCount; ++i)
     {
-        Particle& particle = m_particleData[i];
-        if (particle.lastTickFrame >= m_simulationStep)
+        Chunk& chunk = m_chunks[i];
+        chunk.current = chunk.next.load();
+        chunk.next.reset();
+        if (m_backend == SimulationBackend::Margolus)
         {
-            continue;
+            const DirtyRect woken = chunk.current;
+            if (!chunk.previous.isEmpty())
+            {
+                chunk.current.expand(chunk.previous.minX, chunk.previous.minY, chunk.previous.maxX, chunk.previous.maxY);
+            }
+            chunk.previous = woken;
         }
+        chunk.particlesTicked = 0u;
+        chunk.particlesMoved = 0u;
+        activeChunks += chunk.current.isEmpty() ? 0u : 1u;
+    }
+
+    if (m_backend == SimulationBackend::Margolus)
+    {
+        tickMargolus();
+    }
+    else if (m_threadPool.get() != nullptr)
+    {
+        tickCheckerboard();
+    }
+    else
+    {
+        tickRows();
+    }
 
-        particle.lastTickFrame = m_simulationStep;
+    const auto colorStart = steady_clock::now();
 
-        TickFunction tickFunction = m_particleRegistry->getTickFunction(particle.type);
-        if (tickFunction != nullptr)
+    // Copy the color of every particle that may have changed into the color data array. Every
+    // updated bit set this step lies inside one of the same rects, so clear those masks too.
+    auto copyChunkColors = [this](int i)
+    {
+        const DirtyRect& current = m_chunks[i].current;
+        const DirtyRect next = m_chunks[i].next.load();
+        if (current.isEmpty() && next.isEmpty())
         {
-            tickFunction(this, particle, indexToX(i), indexToY(i));
+            return;
         }
-    }
 
-    // Copy the color for each particle into the color data array.
-    for (int i = 0; i < m_dataSize; ++i)
+        if (m_isColorOutputEnabled)
+        {
+            copyColors(current);
+            copyColors(next);
+        }
+        clearUpdatedMask(i);
+
+        DirtyRect& colorChanged = m_chunks[i].colorChanged;
+        if (!current.isEmpty())
+        {
+            colorChanged.expand(current.minX, current.minY, current.maxX, current.maxY);
+        }
+        if (!next.isEmpty())
+        {
+            colorChanged.expand(next.minX, next.minY, next.maxX, next.maxY);
+        }
+    };
+    if (m_threadPool.get() != nullptr)
     {
-        m_colorData[i] = m_particleData[i].color;
+        m_threadPool->parallelFor(chunkCount, copyChunkColors);
+    }
+    else
+    {
+        for (int i = 0; i < chunkCount; ++i)
+        {
+            copyChunkColors(i);
+        }
     }
 
-    auto t2 = high_resolution_clock::now();
-    auto ms_int = duration_cast<milliseconds>(t2 - t1);
+    const auto colorEnd = steady_clock::now();
 
-    //std::cout << "SASI: Fixed delta time is " << fixedDeltaTime << ". Particle simulation complete in " << ms_int.count() << "ms\n";
+    m_lastStepMetrics.tickSecs = duration<double>(colorStart - tickStart).count();
+    m_lastStepMetrics.colorSecs = duration<double>(colorEnd - colorStart).count();
+    m_lastStepMetrics.particlesTicked = 0u;
+    m_lastStepMetrics.particlesMoved = 0u;
+    m_lastStepMetrics.activeChunks = activeChunks;
+    for (int i = 0; i < chunkCount; ++i)
+    {
+        m_lastStepMetrics.particlesTicked += m_chunks[i].particlesTicked;
+        m_lastStepMetrics.particlesMoved += m_chunks[i].particlesMoved;
+    }
 
     ++m_simulationStep;
+    m_random = CellRandom(m_randomSeed, m_simulationStep);
+}
+
+const sasi::StepMetrics& sasi::ParticleSimulator::getLastStepMetrics() const
+{
+    return m_lastStepMetrics;
+}
+
+uint64_t sasi::ParticleSimulator::getStep() const
+{
+    return m_simulationStep;
+}
+
+void sasi::ParticleSimulator::setStep(uint64_t step)
+{
+    m_simulationStep = step;
+    m_random = CellRandom(m_randomSeed, m_simulationStep);
+}
+
+sasi::SimulatorOptions sasi::ParticleSimulator::getOptions() const
+{
+    SimulatorOptions options;
+    options.threadCount = (m_threadPool.get() != nullptr) ? m_threadPool->getThreadCount() : 1;
+    options.useRowKernels = m_useRowKernels;
+    options.backend = m_backend;
+    options.randomSeed = m_randomSeed;
+    options.velocity = m_velocityOptions;
+    return options;
 }
 
 size_t sasi::ParticleSimulator::getColorDataSize() const
@@ -90,6 +323,211 @@ const uint32_t* sasi::ParticleSimulator::getColorData() const
     return m_colorData.get();
 }
 
+const sasi::ParticleType* sasi::ParticleSimulator::getTypeData() const
+{
+    return &m_types[cellIndex(0, 0)];
+}
+
+int sasi::ParticleSimulator::getPlaneStride() const
+{
+    return m_stride;
+}
+
+void sasi::ParticleSimulator::setColorOutputEnabled(bool enabled)
+{
+    if (enabled == m_isColorOutputEnabled)
+    {
+        return;
+    }
+
+    m_isColorOutputEnabled = enabled;
+    if (!enabled)
+    {
+        return;
+    }
+
+    // The colour data went stale while disabled, bring all of it up to date.
+    copyAllColors();
+    markAllChanged(false);
+}
+
+bool sasi::ParticleSimulator::isColorOutputEnabled() const
+{
+    return m_isColorOutputEnabled;
+}
+
+const uint32_t* sasi::ParticleSimulator::getCellColors() const
+{
+    return &m_colors[cellIndex(0, 0)];
+}
+
+void sasi::ParticleSimulator::loadCells(const ParticleType* types, const uint32_t* colors)
+{
+    for (int y = 0; y < m_height; ++y)
+    {
+        const size_t rowStart = static_cast<size_t>(y) * m_width;
+        std::memcpy(&m_types[cellIndex(0, y)], types + rowStart, static_cast<size_t>(m_width) * sizeof(ParticleType));
+        std::memcpy(&m_colors[cellIndex(0, y)], colors + rowStart, static_cast<size_t>(m_width) * sizeof(uint32_t));
+    }
+    if (m_velocities.get() != nullptr)
+    {
+        std::fill_n(m_velocities.get(), m_planeSize, Velocity{});
+    }
+    if (m_isColorOutputEnabled)
+    {
+        copyAllColors();
+    }
+
+    for (int i = 0; i < m_chunkCountX * m_chunkCountY; ++i)
+    {
+        clearUpdatedMask(i);
+    }
+    markAllChanged(true);
+}
+
+void sasi::ParticleSimulator::readChunkCells(int chunkX, int chunkY, ParticleType* outTypes, uint32_t* outColors) const
+{
+    assert(((chunkX + 1) * k_chunkSize <= m_width) && ((chunkY + 1) * k_chunkSize <= m_height));
+
+    const int minX = chunkX * k_chunkSize;
+    const int minY = chunkY * k_chunkSize;
+    for (int row = 0; row < k_chunkSize; ++row)
+    {
+        const int index = cellIndex(minX, minY + row);
+        std::memcpy(outTypes + (row * k_chunkSize), &m_types[index], k_chunkSize * sizeof(ParticleType));
+        std::memcpy(outColors + (row * k_chunkSize), &m_colors[index], k_chunkSize * sizeof(uint32_t));
+    }
+}
+
+void sasi::ParticleSimulator::writeChunkCells(int chunkX, int chunkY, const ParticleType* types, const uint32_t* colors)
+{
+    assert(((chunkX + 1) * k_chunkSize <= m_width) && ((chunkY + 1) * k_chunkSize <= m_height));
+
+    const int minX = chunkX * k_chunkSize;
+    const int minY = chunkY * k_chunkSize;
+    for (int row = 0; row < k_chunkSize; ++row)
+    {
+        const int index = cellIndex(minX, minY + row);
+        std::memcpy(&m_types[index], types + (row * k_chunkSize), k_chunkSize * sizeof(ParticleType));
+        std::memcpy(&m_colors[index], colors + (row * k_chunkSize), k_chunkSize * sizeof(uint32_t));
+        if (m_velocities.get() != nullptr)
+        {
+            std::fill_n(&m_velocities[index], k_chunkSize, Velocity{});
+        }
+        if (m_isColorOutputEnabled)
+        {
+            std::memcpy(&m_colorData[coordToIndex(minX, minY + row)], colors + (row * k_chunkSize), k_chunkSize * sizeof(uint32_t));
+        }
+    }
+
+    const int maxX = minX + k_chunkSize - 1;
+    const int maxY = minY + k_chunkSize - 1;
+    m_chunks[(chunkY * m_chunkCountX) + chunkX].colorChanged.expand(minX, minY, maxX, maxY);
+    markDirty(minX, minY, maxX, maxY);
+}
+
+void sasi::ParticleSimulator::scrollWorld(int cellsX, int cellsY)
+{
+    // Rows are visited in the direction they move so no source row is overwritten before it is
+    // read, and memmove handles the overlap within a row.
+    const int firstY = (cellsY >= 0) ? 0 : m_height - 1;
+    const int stepY = (cellsY >= 0) ? 1 : -1;
+    const int keptMinX = std::max(-cellsX, 0);
+    const int keptMaxX = std::min(m_width - cellsX, m_width);
+    for (int y = firstY; (y >= 0) && (y < m_height); y += stepY)
+    {
+        const int sourceY = y + cellsY;
+        const int index = cellIndex(0, y);
+        if ((sourceY < 0) || (sourceY >= m_height) || (keptMinX >= keptMaxX))
+        {
+            std::fill_n(&m_types[index], m_width, m_particleVoid.type);
+            std::fill_n(&m_colors[index], m_width, m_particleVoid.color);
+            if (m_velocities.get() != nullptr)
+            {
+                std::fill_n(&m_velocities[index], m_width, Velocity{});
+            }
+            continue;
+        }
+
+        const int sourceIndex = cellIndex(keptMinX + cellsX, sourceY);
+        const size_t keptCount = static_cast<size_t>(keptMaxX - keptMinX);
+        std::memmove(&m_types[index + keptMinX], &m_types[sourceIndex], keptCount * sizeof(ParticleType));
+        std::memmove(&m_colors[index + keptMinX], &m_colors[sourceIndex], keptCount * sizeof(uint32_t));
+
+        std::fill_n(&m_types[index], keptMinX, m_particleVoid.type);
+        std::fill_n(&m_colors[index], keptMinX, m_particleVoid.color);
+        std::fill_n(&m_types[index + keptMaxX], m_width - keptMaxX, m_particleVoid.type);
+        std::fill_n(&m_colors[index + keptMaxX], m_width - keptMaxX, m_particleVoid.color);
+
+        if (m_velocities.get() != nullptr)
+        {
+            std::memmove(&m_velocities[index + keptMinX], &m_velocities[sourceIndex], keptCount * sizeof(Velocity));
+            std::fill_n(&m_velocities[index], keptMinX, Velocity{});
+            std::fill_n(&m_velocities[index + keptMaxX], m_width - keptMaxX, Velocity{});
+        }
+    }
+
+    m_worldOriginX += cellsX;
+    m_worldOriginY += cellsY;
+
+    if (m_isColorOutputEnabled)
+    {
+        copyAllColors();
+    }
+    for (int i = 0; i < m_chunkCountX * m_chunkCountY; ++i)
+    {
+        clearUpdatedMask(i);
+    }
+    markAllChanged(true);
+}
+
+int sasi::ParticleSimulator::getWorldOriginX() const
+{
+    return m_worldOriginX;
+}
+
+int sasi::ParticleSimulator::getWorldOriginY() const
+{
+    return m_worldOriginY;
+}
+
+void sasi::ParticleSimulator::setWorldOrigin(int originX, int originY)
+{
+    m_worldOriginX = originX;
+    m_worldOriginY = originY;
+}
+
+void sasi::ParticleSimulator::buildPalette(uint32_t* outPalette) const
+{
+    for (int i = 0; i < ParticleRegistry::k_maxParticleTypes; ++i)
+    {
+        const ParticleType type = static_cast<ParticleType>(i);
+        const bool hasColor = (m_particleRegistry->getMakeFunction(type) != nullptr) || m_particleRegistry->getMaterials().isDefined(type);
+        outPalette[i] = hasColor ? make(type).color : 0x00000000;
+    }
+
+    outPalette[static_cast<uint8_t>(ParticleType::Void)] = m_particleVoid.color;
+    outPalette[static_cast<uint8_t>(ParticleType::OutOfBounds)] = m_particleOutOfBounds.color;
+}
+
+void sasi::ParticleSimulator::consumeDirtyRects(std::vector<DirtyRect>& outRects)
+{
+    const int chunkCount = m_chunkCountX * m_chunkCountY;
+    for (int i = 0; i < chunkCount; ++i)
+    {
+        DirtyRect& colorChanged = m_chunks[i].colorChanged;
+        if (!colorChanged.isEmpty())
+        {
+            m_dirtyRectScratch.push_back(colorChanged);
+            colorChanged = DirtyRect{};
+        }
+    }
+
+    mergeDirtyRects(m_dirtyRectScratch);
+    outRects.insert(outRects.end(), m_dirtyRectScratch.begin(), m_dirtyRectScratch.end());
+    m_dirtyRectScratch.clear();
+}
+
 bool sasi::ParticleSimulator::isValidCoord(int x, int y) const
 {
     return (x >= 0) && (x < m_width) && (y >= 0) && (y < m_height);
@@ -119,11 +557,11 @@ void sasi::ParticleSimulator::setParticle(int x, int y, const Particle& particle
 {
     if (!isValidCoord(x, y))
     {
-        std::cout << "SASI (WARNING): sasi::ParticleSimulator::setParticle was called with an out-of-bounds coord.\n";
+        SASI_LOG_WARNING("sasi::ParticleSimulator::setParticle was called with an out-of-bounds coord %d,%d.", x, y);
         return;
     }
 
-    setParticle(coordToIndex(x, y), particle);
+    writeParticle(x, y, particle);
 }
 
 void sasi::ParticleSimulator::setParticle(int index, const Particle& particle)
@@ -133,79 +571,805 @@ void sasi::ParticleSimulator::setParticle(int index, const Particle& particle)
         return;
     }
 
-    m_particleData[index] = particle;
+    writeParticle(indexToX(index), indexToY(index), particle);
 }
 
-const sasi::Particle& sasi::ParticleSimulator::getParticle(int index) const
+sasi::Particle sasi::ParticleSimulator::getParticle(int index) const
 {
     if (!isValidIndex(index))
     {
         return m_particleOutOfBounds;
     }
 
-    return m_particleData[index];
+    const int cell = cellIndex(indexToX(index), indexToY(index));
+    return Particle{ m_types[cell], m_colors[cell] };
 }
 
-const sasi::Particle& sasi::ParticleSimulator::getParticle(int x, int y) const
+sasi::Particle sasi::ParticleSimulator::getParticle(int x, int y) const
 {
     if (!isValidCoord(x, y))
     {
         return m_particleOutOfBounds;
     }
 
-    return getParticle(coordToIndex(x, y));
+    const int cell = cellIndex(x, y);
+    return Particle{ m_types[cell], m_colors[cell] };
 }
 
-void sasi::ParticleSimulator::makeParticleAtWorldLocation(ParticleType type, const bx::Vec3& worldLocation)
+sasi::ParticleType sasi::ParticleSimulator::getType(int index) const
 {
-    // ASSUMPTION: this object is always at the world origin with the 0,0 particle being top left.
+    if (!isValidIndex(index))
+    {
+        return ParticleType::OutOfBounds;
+    }
+
+    return m_types[cellIndex(indexToX(index), indexToY(index))];
+}
+
+sasi::ParticleType sasi::ParticleSimulator::getType(int x, int y) const
+{
+    if (!isValidCoord(x, y))
+    {
+        return ParticleType::OutOfBounds;
+    }
+
+    return m_types[cellIndex(x, y)];
+}
 
-    // Scale the world location using the pixels-per-unit value, trunc-ing any remainder.
-    int particleX = static_cast<int>(worldLocation.x * sasi::k_pixelsPerUnit);
-    int particleY = static_cast<int>(worldLocation.y * sasi::k_pixelsPerUnit);
+void sasi::ParticleSimulator::makeParticleAtWorldLocation(ParticleType type, float worldX, float worldY)
+{
+    int particleX = 0;
+    int particleY = 0;
+    worldToCell(worldX, worldY, particleX, particleY);
 
     if (!isValidCoord(particleX, particleY))
     {
-        std::cout << "SASI (WARNING): makeParticleAtWorldLocation called with out-of-bounds location\n";
+        SASI_LOG_WARNING("makeParticleAtWorldLocation called with out-of-bounds location %g,%g", worldX, worldY);
         return;
     }
 
-    setParticle(coordToIndex(particleX, particleY), make(type));
+    writeParticle(particleX, particleY, make(type));
+}
+
+void sasi::ParticleSimulator::worldToCell(float worldX, float worldY, int& outX, int& outY) const
+{
+    // The 0,0 particle is top left and stands for the world cell at the world origin.
+
+    // Scale the world location using the pixels-per-unit value, flooring any remainder so cells
+    // left of and above the world origin round the same way as the rest.
+    outX = static_cast<int>(std::floor(worldX * sasi::k_pixelsPerUnit)) - m_worldOriginX;
+    outY = static_cast<int>(std::floor(worldY * sasi::k_pixelsPerUnit)) - m_worldOriginY;
+}
+
+void sasi::ParticleSimulator::fillRect(int minX, int minY, int maxX, int maxY, ParticleType type, float density, uint32_t seed)
+{
+    if (minX > maxX)
+    {
+        std::swap(minX, maxX);
+    }
+    if (minY > maxY)
+    {
+        std::swap(minY, maxY);
+    }
+
+    beginBrushSpans(minY, maxY);
+    for (int y = minY; y <= maxY; ++y)
+    {
+        addBrushSpan(y, minX, maxX);
+    }
+    fillBrushSpans(type, density, seed);
+}
+
+void sasi::ParticleSimulator::fillCircle(int centerX, int centerY, int radius, ParticleType type, float density, uint32_t seed)
+{
+    fillLine(centerX, centerY, centerX, centerY, radius, type, density, seed);
+}
+
+void sasi::ParticleSimulator::fillLine(int fromX, int fromY, int toX, int toY, int radius, ParticleType type, float density, uint32_t seed)
+{
+    radius = std::max(radius, 0);
+
+    // Half the width of the disc on each of its rows. Adding the radius once more rounds the
+    // disc out so small ones are not diamonds.
+    std::vector<int> halfWidths(static_cast<size_t>(radius) + 1);
+    for (int dy = 0; dy <= radius; ++dy)
+    {
+        halfWidths[dy] = static_cast<int>(std::sqrt(static_cast<double>((radius * radius) + radius - (dy * dy))));
+    }
+
+    beginBrushSpans(std::min(fromY, toY) - radius, std::max(fromY, toY) + radius);
+    if (m_brushSpans.empty() || (std::max(fromX, toX) + radius < 0) || (std::min(fromX, toX) - radius >= m_width))
+    {
+        return;
+    }
+
+    // Walk the line with Bresenham's algorithm and stamp the disc at every cell. The shape is
+    // convex, so each row stays a single span.
+    const int deltaX = std::abs(toX - fromX);
+    const int deltaY = -std::abs(toY - fromY);
+    const int stepX = (fromX < toX) ? 1 : -1;
+    const int stepY = (fromY < toY) ? 1 : -1;
+    int error = deltaX + deltaY;
+    int x = fromX;
+    int y = fromY;
+    while (true)
+    {
+        for (int dy = -radius; dy <= radius; ++dy)
+        {
+            const int halfWidth = halfWidths[std::abs(dy)];
+            addBrushSpan(y + dy, x - halfWidth, x + halfWidth);
+        }
+
+        if ((x == toX) && (y == toY))
+        {
+            break;
+        }
+
+        const int doubledError = error * 2;
+        if (doubledError >= deltaY)
+        {
+            error += deltaY;
+            x += stepX;
+        }
+        if (doubledError <= deltaX)
+        {
+            error += deltaX;
+            y += stepY;
+        }
+    }
+
+    fillBrushSpans(type, density, seed);
 }
 
 void sasi::ParticleSimulator::move(int fromX, int fromY, int toX, int toY, const Particle& replace)
 {
+    assert((std::abs(toX - fromX) <= k_tickReach) && (std::abs(toY - fromY) <= k_tickReach));
+
     if (!isValidCoord(fromX, fromY))
     {
         return;
     }
 
-    // Move the particle to the new coord.
-    setParticle(toX, toY, getParticle(fromX, fromY));
+    if (!isValidCoord(toX, toY))
+    {
+        setParticle(toX, toY, getParticle(fromX, fromY));
+        setParticle(fromX, fromY, replace);
+        return;
+    }
 
-    // Replace the original particle.
-    setParticle(fromX, fromY, replace);
+    moveUnchecked(fromX, fromY, toX, toY, replace);
 }
 
 sasi::Particle sasi::ParticleSimulator::make(sasi::ParticleType type) const
 {
+    // Void is made on every move, skip the table for it.
+    if (type == ParticleType::Void)
+    {
+        return m_particleVoid;
+    }
+
     MakeFunction makeFunction = m_particleRegistry->getMakeFunction(type);
     if (makeFunction != nullptr)
     {
         return makeFunction(this);
     }
 
+    const MaterialTable& materials = m_particleRegistry->getMaterials();
+    if (materials.isDefined(type))
+    {
+        return Particle{ type, materials.getColor(type) };
+    }
+
     return m_particleVoid;
 }
 
+sasi::ParticleType sasi::ParticleSimulator::registerParticle(TickFunction tickFunction, MakeFunction makeFunction)
+{
+    return m_particleRegistry->registerParticle(tickFunction, makeFunction);
+}
+
+sasi::ParticleType sasi::ParticleSimulator::registerMaterial(const MaterialDefinition& definition)
+{
+    return m_particleRegistry->registerMaterial(definition);
+}
+
+const sasi::MaterialTable& sasi::ParticleSimulator::getMaterials() const
+{
+    return m_particleRegistry->getMaterials();
+}
+
+uint32_t sasi::ParticleSimulator::getCellRandom(int x, int y) const
+{
+    return m_random.get(x + m_worldOriginX, y + m_worldOriginY);
+}
+
+const sasi::CellRandom& sasi::ParticleSimulator::getRandom() const
+{
+    return m_random;
+}
+
+const sasi::VelocityOptions& sasi::ParticleSimulator::getVelocityOptions() const
+{
+    return m_velocityOptions;
+}
+
 void sasi::ParticleSimulator::swap(int fromX, int fromY, int toX, int toY)
 {
+    assert((std::abs(toX - fromX) <= k_tickReach) && (std::abs(toY - fromY) <= k_tickReach));
+
     if (!isValidCoord(fromX, fromY) || !isValidCoord(toX, toY))
     {
         return;
     }
 
-    Particle temp = getParticle(fromX, fromY);
-    setParticle(fromX, fromY, getParticle(toX, toY));
-    setParticle(toX, toY, temp);
-}
\ No newline at end of file
+    swapUnchecked(fromX, fromY, toX, toY);
+}
+
+void sasi::ParticleSimulator::moveUnchecked(int fromX, int fromY, int toX, int toY, const Particle& replace)
+{
+    assert(isValidCoord(fromX, fromY) && isValidCoord(toX, toY));
+
+    // Move the particle to the new coord.
+    copyCell(fromX, fromY, toX, toY);
+    markDirty(toX, toY, toX, toY);
+
+    // Replace the original particle.
+    writeParticle(fromX, fromY, replace);
+}
+
+void sasi::ParticleSimulator::swapUnchecked(int fromX, int fromY, int toX, int toY)
+{
+    assert(isValidCoord(fromX, fromY) && isValidCoord(toX, toY));
+
+    const int fromIndex = cellIndex(fromX, fromY);
+    const int toIndex = cellIndex(toX, toY);
+    std::swap(m_types[fromIndex], m_types[toIndex]);
+    std::swap(m_colors[fromIndex], m_colors[toIndex]);
+    if (m_velocities.get() != nullptr)
+    {
+        std::swap(m_velocities[fromIndex], m_velocities[toIndex]);
+    }
+
+    const bool fromUpdated = isUpdated(fromX, fromY);
+    setUpdated(fromX, fromY, isUpdated(toX, toY));
+    setUpdated(toX, toY, fromUpdated);
+
+    markDirty(fromX, fromY, fromX, fromY);
+    markDirty(toX, toY, toX, toY);
+}
+
+int sasi::ParticleSimulator::getChunkCountX() const
+{
+    return m_chunkCountX;
+}
+
+int sasi::ParticleSimulator::getChunkCountY() const
+{
+    return m_chunkCountY;
+}
+
+const sasi::Chunk& sasi::ParticleSimulator::getChunk(int chunkX, int chunkY) const
+{
+    return m_chunks[(chunkY * m_chunkCountX) + chunkX];
+}
+
+void sasi::ParticleSimulator::tickParticle(int x, int y, uint32_t& updatedRow, Chunk& chunk)
+{
+    // The cell belongs to the chunk being ticked and no other thread writes into that chunk's
+    // masks, so this test-and-set needs no atomics.
+    const uint32_t bit = 1u << (static_cast<unsigned int>(x) % k_chunkSize);
+    if ((updatedRow & bit) != 0u)
+    {
+        return;
+    }
+
+    updatedRow |= bit;
+
+    // Built-in kernels are called directly so they can be inlined into the loop. Materials all
+    // share the rule kernel. Anything else was registered at runtime and goes through the
+    // registry's dense table.
+    const int index = cellIndex(x, y);
+    const ParticleType type = m_types[index];
+    switch (type)
+    {
+    case ParticleType::Void:
+    case ParticleType::OutOfBounds:
+        return;
+    case ParticleType::Sand:
+        ParticleKernel<ParticleType::Sand>::tick(this, x, y);
+        break;
+    case ParticleType::Water:
+        ParticleKernel<ParticleType::Water>::tick(this, x, y);
+        break;
+    default:
+        if (const MaterialTable& materials = m_particleRegistry->getMaterials(); materials.isDefined(type))
+        {
+            materialTick(this, materials, x, y, type);
+        }
+        else if (TickFunction tickFunction = m_particleRegistry->getTickFunction(type); tickFunction != nullptr)
+        {
+            tickFunction(this, x, y);
+        }
+        break;
+    }
+
+    // A particle that left its cell, by moving or swapping, finds something else there now.
+    ++chunk.particlesTicked;
+    chunk.particlesMoved += (m_types[index] != type) ? 1u : 0u;
+}
+
+void sasi::ParticleSimulator::tickChunkRow(int chunkX, int y, Chunk& chunk, uint32_t& updatedRow)
+{
+    const DirtyRect& rect = chunk.current;
+    const int chunkMinX = chunkX * k_chunkSize;
+
+    // Find the particles that will fall straight down no matter what their neighbours in this
+    // row do and move them all at once. Only the rest need the per-cell tick.
+    uint32_t falls = 0u;
+    if (m_useRowKernels)
+    {
+        // The bottom row's row below is the ghost border, which holds no void.
+        const int rowIndex = cellIndex(chunkMinX, y);
+        const ParticleType* row = &m_types[rowIndex];
+        const ParticleType* below = &m_types[rowIndex + m_stride];
+
+        // The last chunk of a grid whose width is not a multiple of 32 is partial, and 32 cells
+        // from it would run over the ghost border into the start of the next row, which the
+        // first chunk column may be writing at the same time. Classify a copy of the live
+        // cells padded with OutOfBounds instead.
+        ParticleType rowCopy[k_chunkSize];
+        ParticleType belowCopy[k_chunkSize];
+        const int liveCount = m_width - chunkMinX;
+        if (liveCount < k_chunkSize)
+        {
+            std::fill(rowCopy + liveCount, rowCopy + k_chunkSize, ParticleType::OutOfBounds);
+            std::fill(belowCopy + liveCount, belowCopy + k_chunkSize, ParticleType::OutOfBounds);
+            std::memcpy(rowCopy, row, liveCount * sizeof(ParticleType));
+            std::memcpy(belowCopy, below, liveCount * sizeof(ParticleType));
+            row = rowCopy;
+            below = belowCopy;
+        }
+        const RowMasks masks = classifyRow(row, below);
+
+        const int firstBit = rect.minX - chunkMinX;
+        const int lastBit = rect.maxX - chunkMinX;
+        const uint32_t inRect = (~0u >> (31 - lastBit)) & (~0u << firstBit);
+        const uint32_t ticked = masks.active & ~updatedRow & inRect;
+        falls = findUncontestedFalls(ticked, ticked & masks.fallers & masks.belowVoid);
+        if (falls != 0u)
+        {
+            applyFalls(chunkMinX, y, falls);
+
+            const uint32_t fallCount = static_cast<uint32_t>(__builtin_popcount(falls));
+            chunk.particlesTicked += fallCount;
+            chunk.particlesMoved += fallCount;
+        }
+    }
+
+    for (int x = rect.minX; x <= rect.maxX; ++x)
+    {
+        if (((falls >> (x - chunkMinX)) & 1u) != 0u)
+        {
+            continue;
+        }
+
+        tickParticle(x, y, updatedRow, chunk);
+    }
+}
+
+void sasi::ParticleSimulator::applyFalls(int chunkMinX, int y, uint32_t falls)
+{
+    const int rowIndex = cellIndex(chunkMinX, y);
+    const int belowIndex = rowIndex + m_stride;
+    for (uint32_t remaining = falls; remaining != 0u; remaining &= remaining - 1u)
+    {
+        const int i = __builtin_ctz(remaining);
+        m_types[belowIndex + i] = m_types[rowIndex + i];
+        m_colors[belowIndex + i] = m_colors[rowIndex + i];
+        m_types[rowIndex + i] = m_particleVoid.type;
+        m_colors[rowIndex + i] = m_particleVoid.color;
+    }
+
+    // The particles count as updated in the cells they fell into. The cells they left hold
+    // fresh void, whose bits were never set.
+    writeUpdatedBits(updatedWord(chunkMinX, y + 1), falls, falls);
+
+    const int firstX = chunkMinX + __builtin_ctz(falls);
+    const int lastX = chunkMinX + 31 - __builtin_clz(falls);
+    markDirty(firstX, y, lastX, y + 1);
+}
+
+void sasi::ParticleSimulator::tickRows()
+{
+    // Invoke the tick function for each particle inside an awake chunk. Rows are visited in the
+    // same top-to-bottom, left-to-right order as a full scan of the grid would.
+    for (int chunkY = 0; chunkY < m_chunkCountY; ++chunkY)
+    {
+        const Chunk* chunkRow = &m_chunks[chunkY * m_chunkCountX];
+
+        int awakeCount = 0;
+        for (int chunkX = 0; chunkX < m_chunkCountX; ++chunkX)
+        {
+            if (!chunkRow[chunkX].current.isEmpty())
+            {
+                m_awakeChunkColumns[awakeCount++] = chunkX;
+            }
+        }
+
+        const int rowBegin = chunkY * k_chunkSize;
+        const int rowEnd = std::min(rowBegin + k_chunkSize, m_height);
+        for (int y = rowBegin; (y < rowEnd) && (awakeCount > 0); ++y)
+        {
+            for (int awake = 0; awake < awakeCount; ++awake)
+            {
+                const int chunkIndex = (chunkY * m_chunkCountX) + m_awakeChunkColumns[awake];
+                Chunk& chunk = m_chunks[chunkIndex];
+                if ((y < chunk.current.minY) || (y > chunk.current.maxY))
+                {
+                    continue;
+                }
+
+                tickChunkRow(m_awakeChunkColumns[awake], y, chunk, m_updatedMasks[chunkIndex].rows[y - rowBegin]);
+            }
+        }
+    }
+}
+
+void sasi::ParticleSimulator::tickCheckerboard()
+{
+    // Chunks sharing a phase are separated by a full chunk on both axes. Given the tick reach
+    // contract none of them can touch the cells another one reads or writes, so each phase can
+    // be spread over the pool. Results do not depend on the number of threads.
+    for (int phase = 0; phase < 4; ++phase)
+    {
+        const int phaseX = phase & 1;
+        const int phaseY = phase >> 1;
+
+        m_phaseChunks.clear();
+        for (int chunkY = phaseY; chunkY < m_chunkCountY; chunkY += 2)
+        {
+            for (int chunkX = phaseX; chunkX < m_chunkCountX; chunkX += 2)
+            {
+                const int chunkIndex = (chunkY * m_chunkCountX) + chunkX;
+                if (!m_chunks[chunkIndex].current.isEmpty())
+                {
+                    m_phaseChunks.push_back(chunkIndex);
+                }
+            }
+        }
+
+        m_threadPool->parallelFor(static_cast<int>(m_phaseChunks.size()), [this](int i)
+        {
+            const int chunkIndex = m_phaseChunks[i];
+            Chunk& chunk = m_chunks[chunkIndex];
+            for (int y = chunk.current.minY; y <= chunk.current.maxY; ++y)
+            {
+                tickChunkRow(chunkIndex % m_chunkCountX, y, chunk, m_updatedMasks[chunkIndex].rows[y % k_chunkSize]);
+            }
+        });
+    }
+}
+
+void sasi::ParticleSimulator::tickMargolus()
+{
+    const int offset = static_cast<int>(m_simulationStep & 1u);
+    const int chunkCount = m_chunkCountX * m_chunkCountY;
+    if (m_threadPool.get() != nullptr)
+    {
+        m_threadPool->parallelFor(chunkCount, [this, offset](int i)
+        {
+            tickMargolusChunk(i, offset);
+        });
+        return;
+    }
+
+    for (int i = 0; i < chunkCount; ++i)
+    {
+        tickMargolusChunk(i, offset);
+    }
+}
+
+void sasi::ParticleSimulator::tickMargolusChunk(int chunkIndex, int offset)
+{
+    Chunk& chunk = m_chunks[chunkIndex];
+    const DirtyRect& rect = chunk.current;
+    if (rect.isEmpty())
+    {
+        return;
+    }
+
+    // Each block belongs to the chunk holding its top left cell, so no two chunks ever touch
+    // the same block. Blocks reaching one cell to the left of or above the rect still cover
+    // it, and on odd steps the first blocks start in the ghost border.
+    const int chunkMinX = (chunkIndex % m_chunkCountX) * k_chunkSize;
+    const int chunkMinY = (chunkIndex / m_chunkCountX) * k_chunkSize;
+    int firstX = std::max(rect.minX - 1, (chunkMinX == 0) ? -offset : chunkMinX);
+    int firstY = std::max(rect.minY - 1, (chunkMinY == 0) ? -offset : chunkMinY);
+    firstX += (firstX - offset) & 1;
+    firstY += (firstY - offset) & 1;
+
+    uint32_t particlesTicked = 0u;
+    uint32_t particlesMoved = 0u;
+    DirtyRect changed{};
+    for (int y = firstY; y <= rect.maxY; y += 2)
+    {
+        for (int x = firstX; x <= rect.maxX; x += 2)
+        {
+            const int index[4] = { cellIndex(x, y), cellIndex(x, y) + 1, cellIndex(x, y) + m_stride, cellIndex(x, y) + m_stride + 1 };
+            const ParticleType types[4] = { m_types[index[0]], m_types[index[1]], m_types[index[2]], m_types[index[3]] };
+            const uint8_t state = static_cast<uint8_t>(
+                m_blockClasses[static_cast<uint8_t>(types[0])]
+                | (m_blockClasses[static_cast<uint8_t>(types[1])] << 2)
+                | (m_blockClasses[static_cast<uint8_t>(types[2])] << 4)
+                | (m_blockClasses[static_cast<uint8_t>(types[3])] << 6));
+            particlesTicked += ((state & 0x03u) != 0u) + ((state & 0x0Cu) != 0u) + ((state & 0x30u) != 0u) + ((state & 0xC0u) != 0u);
+
+            const uint8_t rule = m_blockRules[state];
+            if (rule == k_identityBlockRule)
+            {
+                continue;
+            }
+
+            const uint32_t colors[4] = { m_colors[index[0]], m_colors[index[1]], m_colors[index[2]], m_colors[index[3]] };
+            for (int cell = 0; cell < 4; ++cell)
+            {
+                const int source = (rule >> (cell * 2)) & 3;
+                m_types[index[cell]] = types[source];
+                m_colors[index[cell]] = colors[source];
+                particlesMoved += ((source != cell) && (types[source] != ParticleType::Void)) ? 1u : 0u;
+            }
+
+            // Only movable cells change and those are always inside the grid.
+            changed.expand(std::max(x, 0), std::max(y, 0), std::min(x + 1, m_width - 1), std::min(y + 1, m_height - 1));
+        }
+    }
+
+    if (!changed.isEmpty())
+    {
+        markDirty(changed.minX, changed.minY, changed.maxX, changed.maxY);
+    }
+    chunk.particlesTicked = particlesTicked;
+    chunk.particlesMoved = particlesMoved;
+}
+
+void sasi::ParticleSimulator::writeParticle(int x, int y, const Particle& particle)
+{
+    const int index = cellIndex(x, y);
+    m_types[index] = particle.type;
+    m_colors[index] = particle.color;
+    if (m_velocities.get() != nullptr)
+    {
+        m_velocities[index] = Velocity{};
+    }
+
+    // A freshly written particle has not been updated yet.
+    setUpdated(x, y, false);
+
+    markDirty(x, y, x, y);
+}
+
+void sasi::ParticleSimulator::copyCell(int fromX, int fromY, int toX, int toY)
+{
+    const int fromIndex = cellIndex(fromX, fromY);
+    const int toIndex = cellIndex(toX, toY);
+    m_types[toIndex] = m_types[fromIndex];
+    m_colors[toIndex] = m_colors[fromIndex];
+    if (m_velocities.get() != nullptr)
+    {
+        m_velocities[toIndex] = m_velocities[fromIndex];
+    }
+    setUpdated(toX, toY, isUpdated(fromX, fromY));
+}
+
+uint32_t& sasi::ParticleSimulator::updatedWord(int x, int y) const
+{
+    // Coords are valid, so unsigned maths lets the divisions become shifts.
+    const unsigned int ux = static_cast<unsigned int>(x);
+    const unsigned int uy = static_cast<unsigned int>(y);
+    const unsigned int chunkIndex = ((uy / k_chunkSize) * m_chunkCountX) + (ux / k_chunkSize);
+    return m_updatedMasks[chunkIndex].rows[uy % k_chunkSize];
+}
+
+bool sasi::ParticleSimulator::isUpdated(int x, int y) const
+{
+    return (updatedWord(x, y) >> (static_cast<unsigned int>(x) % k_chunkSize)) & 1u;
+}
+
+void sasi::ParticleSimulator::setUpdated(int x, int y, bool updated)
+{
+    const uint32_t bit = 1u << (static_cast<unsigned int>(x) % k_chunkSize);
+    writeUpdatedBits(updatedWord(x, y), bit, updated ? bit : 0u);
+}
+
+void sasi::ParticleSimulator::writeUpdatedBits(uint32_t& word, uint32_t bits, uint32_t values)
+{
+    // Chunks ticking at the same time can both reach into the same row word of the chunk
+    // between them, so the threaded update needs atomic read-modify-writes.
+    if (m_threadPool.get() != nullptr)
+    {
+        if ((bits & values) != 0u)
+        {
+            __atomic_fetch_or(&word, bits & values, __ATOMIC_RELAXED);
+        }
+        if ((bits & ~values) != 0u)
+        {
+            __atomic_fetch_and(&word, ~(bits & ~values), __ATOMIC_RELAXED);
+        }
+        return;
+    }
+
+    word = (word & ~bits) | (bits & values);
+}
+
+void sasi::ParticleSimulator::clearUpdatedMask(int chunkIndex)
+{
+    uint32_t* rows = m_updatedMasks[chunkIndex].rows;
+#if defined(__AVX__)
+    const __m256i zero = _mm256_setzero_si256();
+    for (int row = 0; row < k_chunkSize; row += 8)
+    {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(rows + row), zero);
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (int row = 0; row < k_chunkSize; row += 4)
+    {
+        _mm_store_si128(reinterpret_cast<__m128i*>(rows + row), zero);
+    }
+#else
+    std::fill_n(rows, k_chunkSize, 0u);
+#endif
+}
+
+void sasi::ParticleSimulator::markDirty(int changedMinX, int changedMinY, int changedMaxX, int changedMaxY)
+{
+    const int minX = std::max(changedMinX - 1, 0);
+    const int minY = std::max(changedMinY - 1, 0);
+    const int maxX = std::min(changedMaxX + 1, m_width - 1);
+    const int maxY = std::min(changedMaxY + 1, m_height - 1);
+
+    const int minChunkX = minX / k_chunkSize;
+    const int minChunkY = minY / k_chunkSize;
+    const int maxChunkX = maxX / k_chunkSize;
+    const int maxChunkY = maxY / k_chunkSize;
+    for (int chunkY = minChunkY; chunkY <= maxChunkY; ++chunkY)
+    {
+        const int chunkMinY = chunkY * k_chunkSize;
+        for (int chunkX = minChunkX; chunkX <= maxChunkX; ++chunkX)
+        {
+            const int chunkMinX = chunkX * k_chunkSize;
+            m_chunks[(chunkY * m_chunkCountX) + chunkX].next.expand(
+                std::max(minX, chunkMinX),
+                std::max(minY, chunkMinY),
+                std::min(maxX, chunkMinX + k_chunkSize - 1),
+                std::min(maxY, chunkMinY + k_chunkSize - 1));
+        }
+    }
+}
+
+void sasi::ParticleSimulator::markAllChanged(bool wake)
+{
+    for (int chunkY = 0; chunkY < m_chunkCountY; ++chunkY)
+    {
+        for (int chunkX = 0; chunkX < m_chunkCountX; ++chunkX)
+        {
+            const int minX = chunkX * k_chunkSize;
+            const int minY = chunkY * k_chunkSize;
+            const int maxX = std::min(minX + k_chunkSize, m_width) - 1;
+            const int maxY = std::min(minY + k_chunkSize, m_height) - 1;
+
+            Chunk& chunk = m_chunks[(chunkY * m_chunkCountX) + chunkX];
+            chunk.colorChanged.expand(minX, minY, maxX, maxY);
+            if (wake)
+            {
+                chunk.next.expand(minX, minY, maxX, maxY);
+            }
+        }
+    }
+}
+
+void sasi::ParticleSimulator::beginBrushSpans(int minY, int maxY)
+{
+    m_brushMinY = std::max(minY, 0);
+    const int rowCount = std::max(std::min(maxY, m_height - 1) - m_brushMinY + 1, 0);
+    m_brushSpans.resize(static_cast<size_t>(rowCount) * 2);
+    for (int row = 0; row < rowCount; ++row)
+    {
+        m_brushSpans[(row * 2) + 0] = m_width;
+        m_brushSpans[(row * 2) + 1] = -1;
+    }
+}
+
+void sasi::ParticleSimulator::addBrushSpan(int y, int minX, int maxX)
+{
+    const int row = y - m_brushMinY;
+    if ((row < 0) || (static_cast<size_t>(row * 2) >= m_brushSpans.size()))
+    {
+        return;
+    }
+
+    m_brushSpans[(row * 2) + 0] = std::min(m_brushSpans[(row * 2) + 0], std::max(minX, 0));
+    m_brushSpans[(row * 2) + 1] = std::max(m_brushSpans[(row * 2) + 1], std::min(maxX, m_width - 1));
+}
+
+void sasi::ParticleSimulator::fillBrushSpans(ParticleType type, float density, uint32_t seed)
+{
+    if (density <= 0.0f)
+    {
+        return;
+    }
+
+    const Particle particle = make(type);
+
+    // Cells are kept when their hash falls below the threshold.
+    const bool isSolid = density >= 1.0f;
+    const uint32_t threshold = isSolid ? 0u : static_cast<uint32_t>(static_cast<double>(density) * 4294967295.0);
+
+    DirtyRect changed{};
+    const int rowCount = static_cast<int>(m_brushSpans.size() / 2);
+    for (int row = 0; row < rowCount; ++row)
+    {
+        const int minX = m_brushSpans[(row * 2) + 0];
+        const int maxX = m_brushSpans[(row * 2) + 1];
+        if (minX > maxX)
+        {
+            continue;
+        }
+
+        const int y = m_brushMinY + row;
+        const int index = cellIndex(minX, y);
+        const int count = maxX - minX + 1;
+        if (isSolid)
+        {
+            std::fill_n(&m_types[index], count, particle.type);
+            std::fill_n(&m_colors[index], count, particle.color);
+            if (m_velocities.get() != nullptr)
+            {
+                std::fill_n(&m_velocities[index], count, Velocity{});
+            }
+        }
+        else
+        {
+            const uint32_t worldY = static_cast<uint32_t>(y + m_worldOriginY);
+            for (int i = 0; i < count; ++i)
+            {
+                if (hashCell(seed, static_cast<uint32_t>(minX + i + m_worldOriginX), worldY) < threshold)
+                {
+                    m_types[index + i] = particle.type;
+                    m_colors[index + i] = particle.color;
+                    if (m_velocities.get() != nullptr)
+                    {
+                        m_velocities[index + i] = Velocity{};
+                    }
+                }
+            }
+        }
+        changed.expand(minX, y, maxX, y);
+    }
+
+    // Edits happen between steps, when every updated bit is already clear, so only the
+    // wake-up is left to do.
+    if (!changed.isEmpty())
+    {
+        markDirty(changed.minX, changed.minY, changed.maxX, changed.maxY);
+    }
+}
+
+void sasi::ParticleSimulator::copyColors(const DirtyRect& rect)
+{
+    if (rect.isEmpty())
+    {
+        return;
+    }
+
+    // Rows of a rect are contiguous, so each one is a single vectorised copy.
+    const size_t rowBytes = static_cast<size_t>(rect.maxX - rect.minX + 1) * sizeof(uint32_t);
+    for (int y = rect.minY; y <= rect.maxY; ++y)
+    {
+        std::memcpy(&m_colorData[coordToIndex(rect.minX, y)], &m_colors[cellIndex(rect.minX, y)], rowBytes);
+    }
+}
+void sasi::ParticleSimulator::copyAllColors()
+{
+    copyColors(DirtyRect(0, 0, m_width - 1, m_height - 1));
+}
@@ -0,0 +1,70 @@
+#include "row_kernel.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+#if defined(__AVX2__)
+    uint32_t equalMask(__m256i values, sasi::ParticleType type)
+    {
+        const __m256i pattern = _mm256_set1_epi8(static_cast<char>(type));
+        return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(values, pattern)));
+    }
+#elif defined(__SSE2__)
+    uint32_t equalMask(__m128i low, __m128i high, sasi::ParticleType type)
+    {
+        const __m128i pattern = _mm_set1_epi8(static_cast<char>(type));
+        const uint32_t lowMask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(low, pattern)));
+        const uint32_t highMask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(high, pattern)));
+        return lowMask | (highMask << 16);
+    }
+#endif
+}
+
+sasi::RowMasks sasi::classifyRow(const ParticleType* row, const ParticleType* below)
+{
+    RowMasks masks{ 0u, 0u, 0u };
+
+#if defined(__AVX2__)
+    const __m256i types = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row));
+    masks.active = ~(equalMask(types, ParticleType::Void) | equalMask(types, ParticleType::OutOfBounds));
+    masks.fallers = equalMask(types, ParticleType::Sand) | equalMask(types, ParticleType::Water);
+    if (below != nullptr)
+    {
+        const __m256i belowTypes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(below));
+        masks.belowVoid = equalMask(belowTypes, ParticleType::Void);
+    }
+#elif defined(__SSE2__)
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 16));
+    masks.active = ~(equalMask(low, high, ParticleType::Void) | equalMask(low, high, ParticleType::OutOfBounds));
+    masks.fallers = equalMask(low, high, ParticleType::Sand) | equalMask(low, high, ParticleType::Water);
+    if (below != nullptr)
+    {
+        const __m128i belowLow = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below));
+        const __m128i belowHigh = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + 16));
+        masks.belowVoid = equalMask(belowLow, belowHigh, ParticleType::Void);
+    }
+#else
+    for (int i = 0; i < 32; ++i)
+    {
+        const uint32_t bit = 1u << i;
+        if ((row[i] != ParticleType::Void) && (row[i] != ParticleType::OutOfBounds))
+        {
+            masks.active |= bit;
+        }
+        if ((row[i] == ParticleType::Sand) || (row[i] == ParticleType::Water))
+        {
+            masks.fallers |= bit;
+        }
+        if ((below != nullptr) && (below[i] == ParticleType::Void))
+        {
+            masks.belowVoid |= bit;
+        }
+    }
+#endif
+
+    return masks;
+}
@@ -0,0 +1,429 @@
+#include "simulation_thread.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "log.h"
+#include "particle_simulator.h"
+
+namespace
+{
+    // Rect lists kept while frames go unread are collapsed into their bounding box past this
+    // size, so a reader that stops acquiring frames cannot grow them without bound.
+    const size_t k_maxPendingRects = 256;
+
+    void appendRects(std::vector<sasi::DirtyRect>& pending, const std::vector<sasi::DirtyRect>& rects)
+    {
+        pending.insert(pending.end(), rects.begin(), rects.end());
+        if (pending.size() <= k_maxPendingRects)
+        {
+            return;
+        }
+
+        sasi::mergeDirtyRects(pending);
+        if (pending.size() <= k_maxPendingRects)
+        {
+            return;
+        }
+
+        sasi::DirtyRect bounds{};
+        for (const sasi::DirtyRect& rect : pending)
+        {
+            bounds.expand(rect.minX, rect.minY, rect.maxX, rect.maxY);
+        }
+        pending.assign(1, bounds);
+    }
+}
+
+sasi::SimulationThread::SimulationThread(ParticleSimulator& simulator, const SchedulerOptions& schedulerOptions)
+    : m_simulator(simulator)
+    , m_scheduler(schedulerOptions)
+    , m_recordingStartStep(0ull)
+    , m_replayStartStep(0ull)
+    , m_backFrame(0)
+    , m_frontFrame(1)
+    , m_sharedFrame(2u)
+    , m_acquiredSerial(0ull)
+    , m_publishedSerial(0ull)
+    , m_streamingFocusX(0.0f)
+    , m_streamingFocusY(0.0f)
+    , m_hasStreamingFocus(false)
+    , m_isQuitting(false)
+{
+    // Every frame starts as a full copy of the simulator so the reader has something to show
+    // before the first step is published.
+    const size_t cellCount = static_cast<size_t>(simulator.getColorDataWidth()) * simulator.getColorDataHeight();
+    for (SimulationFrame& frame : m_frames)
+    {
+        frame.colorData.reset(new uint32_t[cellCount]);
+        frame.typeData.reset(new ParticleType[cellCount]);
+        std::memcpy(frame.colorData.get(), simulator.getColorData(), cellCount * sizeof(uint32_t));
+        for (int y = 0; y < simulator.getColorDataHeight(); ++y)
+        {
+            std::memcpy(
+                frame.typeData.get() + (static_cast<size_t>(y) * simulator.getColorDataWidth()),
+                simulator.getTypeData() + (static_cast<size_t>(y) * simulator.getPlaneStride()),
+                static_cast<size_t>(simulator.getColorDataWidth()) * sizeof(ParticleType));
+        }
+        frame.step = simulator.getStep();
+        frame.schedulerStats = m_scheduler.getStats();
+        frame.metrics = m_metrics.summarize();
+        frame.worldOriginX = simulator.getWorldOriginX();
+        frame.worldOriginY = simulator.getWorldOriginY();
+        frame.streamingStats = StreamingStats{};
+        frame.serial = 0ull;
+    }
+
+    m_thread = std::thread(&SimulationThread::threadLoop, this);
+}
+
+sasi::SimulationThread::~SimulationThread()
+{
+    stop();
+}
+
+void sasi::SimulationThread::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_isQuitting = true;
+    }
+    m_wake.notify_all();
+
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+void sasi::SimulationThread::enqueue(SimulationCommand command)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_commands.push_back(std::move(command));
+}
+
+void sasi::SimulationThread::enqueueInput(const InputEvent& event)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_inputs.push_back(event);
+}
+
+void sasi::SimulationThread::startRecording(const std::string& path)
+{
+    enqueue([this, path](ParticleSimulator& simulator)
+    {
+        if (!m_recorder.open(path, describeRecordingSetup(simulator, m_scheduler.getFixedDeltaTime())))
+        {
+            return;
+        }
+        m_recordingStartStep = simulator.getStep();
+        m_recordingStartTime = std::chrono::steady_clock::now();
+
+        // The world the events are applied to is part of the recording too.
+        std::unique_ptr<SnapshotData> data{ new SnapshotData() };
+        captureSnapshot(simulator, *data);
+        m_snapshotWriter.saveAsync(getRecordingStartPath(path), std::move(data), SnapshotEncoding::Raw);
+    });
+}
+
+void sasi::SimulationThread::saveSnapshot(const std::string& path, SnapshotEncoding encoding)
+{
+    enqueue([this, path, encoding](ParticleSimulator& simulator)
+    {
+        std::unique_ptr<SnapshotData> data{ new SnapshotData() };
+        captureSnapshot(simulator, *data);
+        m_snapshotWriter.saveAsync(path, std::move(data), encoding);
+    });
+}
+
+void sasi::SimulationThread::loadSnapshot(const std::string& path)
+{
+    enqueue([this, path](ParticleSimulator& simulator)
+    {
+        // A snapshot only holds the streamed region. The rest of the world it was cut from is
+        // not in the page file, which holds the chunks of the world streamed now.
+        if (m_streamer.get() != nullptr)
+        {
+            SASI_LOG_ERROR("not loading %s, snapshots cannot be loaded while streaming.", path.c_str());
+            return;
+        }
+
+        if (sasi::loadSnapshot(path, simulator))
+        {
+            // Recordings and replays apply to the world they started on, which is gone now.
+            m_recorder.close();
+            m_replay.reset();
+        }
+    });
+}
+
+bool sasi::SimulationThread::startReplay(const std::string& path)
+{
+    std::shared_ptr<InputReplay> replay{ new InputReplay() };
+    if (!replay->load(path))
+    {
+        return false;
+    }
+
+    if ((replay->getWidth() != m_simulator.getColorDataWidth()) || (replay->getHeight() != m_simulator.getColorDataHeight()))
+    {
+        SASI_LOG_ERROR("input recording %s was made on a %dx%d grid", path.c_str(), replay->getWidth(), replay->getHeight());
+        return false;
+    }
+
+    enqueue([this, path, replay](ParticleSimulator& simulator)
+    {
+        const RecordingSetup& setup = replay->getSetup();
+        if (!matchesRecordingSetup(setup, simulator))
+        {
+            SASI_LOG_ERROR("not replaying %s", path.c_str());
+            return;
+        }
+
+        // Replays start from the world the recording did, at the step it did. Like any other
+        // snapshot, that cannot be loaded into a streamed world.
+        if (m_streamer.get() != nullptr)
+        {
+            SASI_LOG_ERROR("not replaying %s, recordings cannot be replayed while streaming.", path.c_str());
+            return;
+        }
+        m_snapshotWriter.wait();
+        if (!sasi::loadSnapshot(getRecordingStartPath(path), simulator))
+        {
+            SASI_LOG_ERROR("not replaying %s", path.c_str());
+            return;
+        }
+        simulator.setStep(setup.startStep);
+
+        // A recording running until now started on a world that is gone.
+        m_recorder.close();
+        m_replay = replay;
+        m_replayStartStep = setup.startStep;
+    });
+    return true;
+}
+
+void sasi::SimulationThread::openMetricsCsv(const std::string& path)
+{
+    // The recorder belongs to the simulation thread, so reach it the same way as the simulator.
+    enqueue([this, path](ParticleSimulator&)
+    {
+        m_metrics.openCsv(path);
+    });
+}
+
+void sasi::SimulationThread::enableStreaming(const StreamingOptions& options)
+{
+    enqueue([this, options](ParticleSimulator& simulator)
+    {
+        std::unique_ptr<ChunkStreamer> streamer{ new ChunkStreamer(simulator, options) };
+        if (streamer->isEnabled())
+        {
+            m_streamer = std::move(streamer);
+        }
+    });
+}
+
+void sasi::SimulationThread::setStreamingFocus(float cellX, float cellY)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_streamingFocusX = cellX;
+    m_streamingFocusY = cellY;
+    m_hasStreamingFocus = true;
+}
+
+const sasi::SimulationFrame& sasi::SimulationThread::acquireFrame(bool& outIsNew)
+{
+    outIsNew = false;
+    if ((m_sharedFrame.load(std::memory_order_relaxed) & k_freshFrameBit) == 0u)
+    {
+        return m_frames[m_frontFrame];
+    }
+
+    // Hand our old frame back and take the fresh one. Only the simulation thread sets the fresh
+    // bit, so it is still set here.
+    const uint32_t shared = m_sharedFrame.exchange(static_cast<uint32_t>(m_frontFrame), std::memory_order_acq_rel);
+    m_frontFrame = static_cast<int>(shared & ~k_freshFrameBit);
+    m_acquiredSerial.store(m_frames[m_frontFrame].serial, std::memory_order_release);
+
+    outIsNew = true;
+    return m_frames[m_frontFrame];
+}
+
+void sasi::SimulationThread::threadLoop()
+{
+    using std::chrono::steady_clock;
+    using std::chrono::duration;
+
+    const double fixedDeltaTime = m_scheduler.getFixedDeltaTime();
+
+    auto previousTime = steady_clock::now();
+    while (true)
+    {
+        const auto now = steady_clock::now();
+        m_scheduler.advance(duration<double>(now - previousTime).count());
+        previousTime = now;
+
+        const double waitSecs = m_scheduler.getTimeUntilNextStep();
+        if (waitSecs > 0.0)
+        {
+            // Sleep until the next step is due, or until we are told to quit.
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait_for(lock, duration<double>(waitSecs), [this]() { return m_isQuitting; });
+            if (m_isQuitting)
+            {
+                return;
+            }
+            continue;
+        }
+
+        runCommands();
+        applyInputs();
+        updateStreaming();
+        const auto updateStart = steady_clock::now();
+        auto stepStart = updateStart;
+        while (m_scheduler.shouldStep(duration<double>(stepStart - updateStart).count()))
+        {
+            if (m_replay.get() != nullptr)
+            {
+                m_replay->applyEventsForStep(m_simulator.getStep() - m_replayStartStep, m_simulator);
+                if (m_replay->isFinished())
+                {
+                    m_replay.reset();
+                }
+            }
+
+            m_simulator.tick(fixedDeltaTime);
+            m_metrics.recordStep(m_simulator.getLastStepMetrics());
+
+            const auto stepEnd = steady_clock::now();
+            m_scheduler.onStepFinished(duration<double>(stepEnd - stepStart).count());
+            stepStart = stepEnd;
+        }
+        m_scheduler.finishUpdate();
+        m_metrics.recordUpdate(m_scheduler.getStats().stepsLastUpdate);
+        publishFrame();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_isQuitting)
+        {
+            return;
+        }
+    }
+}
+
+void sasi::SimulationThread::runCommands()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_runningCommands.swap(m_commands);
+    }
+
+    for (SimulationCommand& command : m_runningCommands)
+    {
+        command(m_simulator);
+    }
+    m_runningCommands.clear();
+}
+
+void sasi::SimulationThread::applyInputs()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_runningInputs.swap(m_inputs);
+    }
+
+    // A replay owns the world until it runs out of events.
+    if (m_replay.get() == nullptr)
+    {
+        const uint64_t timeUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - m_recordingStartTime).count());
+        for (InputEvent& event : m_runningInputs)
+        {
+            applyInputEvent(m_simulator, event);
+            if (m_recorder.isOpen())
+            {
+                event.step = m_simulator.getStep() - m_recordingStartStep;
+                event.timeUs = timeUs;
+                m_recorder.record(event);
+            }
+        }
+    }
+    m_runningInputs.clear();
+}
+
+void sasi::SimulationThread::updateStreaming()
+{
+    if (m_streamer.get() == nullptr)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_hasStreamingFocus)
+        {
+            m_streamer->setFocus(m_streamingFocusX, m_streamingFocusY);
+        }
+    }
+    m_streamer->update();
+}
+
+void sasi::SimulationThread::publishFrame()
+{
+    // Frames are published even when no cell changed so the stats they carry stay current.
+    m_stepRects.clear();
+    m_simulator.consumeDirtyRects(m_stepRects);
+    for (std::vector<DirtyRect>& staleRects : m_staleRects)
+    {
+        appendRects(staleRects, m_stepRects);
+    }
+
+    // Bring the back frame up to date with everything it missed while it was being read.
+    SimulationFrame& frame = m_frames[m_backFrame];
+    for (const DirtyRect& rect : m_staleRects[m_backFrame])
+    {
+        copyRect(frame, rect);
+    }
+    m_staleRects[m_backFrame].clear();
+
+    // The reader needs every change since the frame it holds. Once it has acquired the last
+    // frame we published only this step's changes are new to it. Should it acquire that frame
+    // just after this check, the frame we publish lists more than it needs to, which is harmless.
+    if (m_acquiredSerial.load(std::memory_order_acquire) == m_publishedSerial)
+    {
+        m_unreadRects.clear();
+    }
+    appendRects(m_unreadRects, m_stepRects);
+
+    frame.dirtyRects = m_unreadRects;
+    frame.step = m_simulator.getStep();
+    frame.schedulerStats = m_scheduler.getStats();
+    frame.metrics = m_metrics.summarize();
+    frame.worldOriginX = m_simulator.getWorldOriginX();
+    frame.worldOriginY = m_simulator.getWorldOriginY();
+    frame.streamingStats = (m_streamer.get() != nullptr) ? m_streamer->getStats() : StreamingStats{};
+    frame.serial = ++m_publishedSerial;
+
+    const uint32_t shared = m_sharedFrame.exchange(static_cast<uint32_t>(m_backFrame) | k_freshFrameBit, std::memory_order_acq_rel);
+    m_backFrame = static_cast<int>(shared & ~k_freshFrameBit);
+}
+
+void sasi::SimulationThread::copyRect(SimulationFrame& frame, const DirtyRect& rect) const
+{
+    const int width = m_simulator.getColorDataWidth();
+    const bool copyColors = m_simulator.isColorOutputEnabled();
+    const uint32_t* colorData = m_simulator.getColorData();
+    const ParticleType* typeData = m_simulator.getTypeData();
+    const int typeStride = m_simulator.getPlaneStride();
+    for (int y = rect.minY; y <= rect.maxY; ++y)
+    {
+        const size_t rowStart = (static_cast<size_t>(y) * width) + rect.minX;
+        if (copyColors)
+        {
+            std::memcpy(frame.colorData.get() + rowStart, colorData + rowStart, rect.getWidth() * sizeof(uint32_t));
+        }
+        const size_t typeRowStart = (static_cast<size_t>(y) * typeStride) + rect.minX;
+        std::memcpy(frame.typeData.get() + rowStart, typeData + typeRowStart, rect.getWidth() * sizeof(ParticleType));
+    }
+}
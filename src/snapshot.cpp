@@ -0,0 +1,488 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "particle_simulator.h"
+
+namespace
+{
+    const char k_magic[8] = { 'S', 'A', 'S', 'I', 'S', 'N', 'A', 'P' };
+    const uint32_t k_version = 1u;
+    const uint32_t k_byteOrderMark = 0x01020304u;
+
+    // Planes start on this boundary so they line up with pages when the file is mapped.
+    const uint64_t k_pageSize = 4096u;
+
+    uint64_t alignToPage(uint64_t offset)
+    {
+        return (offset + k_pageSize - 1u) & ~(k_pageSize - 1u);
+    }
+
+    void writePadding(std::ofstream& file, uint64_t from, uint64_t to)
+    {
+        static const char zeros[k_pageSize] = {};
+        file.write(zeros, static_cast<std::streamsize>(to - from));
+    }
+
+    void appendVarint(std::vector<uint8_t>& bytes, uint64_t value)
+    {
+        do
+        {
+            const uint8_t low = static_cast<uint8_t>(value & 0x7Fu);
+            value >>= 7;
+            bytes.push_back(low | ((value != 0u) ? 0x80u : 0u));
+        } while (value != 0u);
+    }
+
+    // Encodes every chunk's cells, row by row within the chunk, as runs of identical cells.
+    // Each run is a varint length, a type byte and a colour. The payload starts with the
+    // offset of every chunk's runs and one past the last.
+    std::vector<uint8_t> encodeChunkRle(const sasi::SnapshotData& data)
+    {
+        const int chunkSize = sasi::ParticleSimulator::k_chunkSize;
+        const int chunkCountX = (data.width + chunkSize - 1) / chunkSize;
+        const int chunkCountY = (data.height + chunkSize - 1) / chunkSize;
+        const size_t chunkCount = static_cast<size_t>(chunkCountX) * chunkCountY;
+
+        std::vector<uint64_t> offsets;
+        offsets.reserve(chunkCount + 1);
+        std::vector<uint8_t> runs;
+        for (int chunkY = 0; chunkY < chunkCountY; ++chunkY)
+        {
+            for (int chunkX = 0; chunkX < chunkCountX; ++chunkX)
+            {
+                offsets.push_back(runs.size());
+
+                const int minX = chunkX * chunkSize;
+                const int maxX = std::min(minX + chunkSize, data.width);
+                const int minY = chunkY * chunkSize;
+                const int maxY = std::min(minY + chunkSize, data.height);
+
+                uint64_t runLength = 0u;
+                sasi::ParticleType runType = sasi::ParticleType::Void;
+                uint32_t runColor = 0u;
+                auto flushRun = [&]()
+                {
+                    if (runLength == 0u)
+                    {
+                        return;
+                    }
+                    appendVarint(runs, runLength);
+                    runs.push_back(static_cast<uint8_t>(runType));
+                    const size_t colorAt = runs.size();
+                    runs.resize(colorAt + sizeof(uint32_t));
+                    std::memcpy(&runs[colorAt], &runColor, sizeof(uint32_t));
+                };
+
+                for (int y = minY; y < maxY; ++y)
+                {
+                    for (int x = minX; x < maxX; ++x)
+                    {
+                        const size_t index = (static_cast<size_t>(y) * data.width) + x;
+                        if ((runLength > 0u) && (data.types[index] == runType) && (data.colors[index] == runColor))
+                        {
+                            ++runLength;
+                            continue;
+                        }
+
+                        flushRun();
+                        runLength = 1u;
+                        runType = data.types[index];
+                        runColor = data.colors[index];
+                    }
+                }
+                flushRun();
+            }
+        }
+        offsets.push_back(runs.size());
+
+        std::vector<uint8_t> payload(offsets.size() * sizeof(uint64_t));
+        std::memcpy(payload.data(), offsets.data(), payload.size());
+        payload.insert(payload.end(), runs.begin(), runs.end());
+        return payload;
+    }
+}
+
+void sasi::captureSnapshot(const ParticleSimulator& simulator, SnapshotData& outData)
+{
+    outData.width = simulator.getColorDataWidth();
+    outData.height = simulator.getColorDataHeight();
+    outData.step = simulator.getStep();
+    outData.worldOriginX = simulator.getWorldOriginX();
+    outData.worldOriginY = simulator.getWorldOriginY();
+    outData.types.clear();
+    outData.colors.clear();
+    outData.types.reserve(simulator.getColorDataSize());
+    outData.colors.reserve(simulator.getColorDataSize());
+
+    // The simulator's planes are padded, so the snapshot's are gathered a row at a time.
+    for (int y = 0; y < outData.height; ++y)
+    {
+        const size_t rowStart = static_cast<size_t>(y) * simulator.getPlaneStride();
+        const ParticleType* types = simulator.getTypeData() + rowStart;
+        const uint32_t* colors = simulator.getCellColors() + rowStart;
+        outData.types.insert(outData.types.end(), types, types + outData.width);
+        outData.colors.insert(outData.colors.end(), colors, colors + outData.width);
+    }
+}
+
+bool sasi::writeSnapshot(const std::string& path, const SnapshotData& data, SnapshotEncoding encoding)
+{
+    const uint64_t cellCount = static_cast<uint64_t>(data.width) * data.height;
+    if ((data.types.size() != cellCount) || (data.colors.size() != cellCount))
+    {
+        SASI_LOG_ERROR("snapshot planes do not match its %dx%d grid", data.width, data.height);
+        return false;
+    }
+
+    // Write to a temporary file and move it over the target, so a crash mid-save never leaves
+    // a broken snapshot behind.
+    const std::string tempPath = path + ".tmp";
+    std::ofstream file(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        SASI_LOG_ERROR("failed to open snapshot %s for writing", tempPath.c_str());
+        return false;
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, k_magic, sizeof(k_magic));
+    header.version = k_version;
+    header.byteOrderMark = k_byteOrderMark;
+    header.encoding = static_cast<uint32_t>(encoding);
+    header.width = static_cast<uint32_t>(data.width);
+    header.height = static_cast<uint32_t>(data.height);
+    header.chunkSize = static_cast<uint32_t>(ParticleSimulator::k_chunkSize);
+    header.step = data.step;
+    header.worldOriginX = data.worldOriginX;
+    header.worldOriginY = data.worldOriginY;
+    header.typeOffset = alignToPage(sizeof(SnapshotHeader));
+
+    if (encoding == SnapshotEncoding::ChunkRle)
+    {
+        const std::vector<uint8_t> payload = encodeChunkRle(data);
+        header.typeSize = payload.size();
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writePadding(file, sizeof(header), header.typeOffset);
+        file.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+    }
+    else
+    {
+        header.typeSize = cellCount * sizeof(ParticleType);
+        header.colorOffset = alignToPage(header.typeOffset + header.typeSize);
+        header.colorSize = cellCount * sizeof(uint32_t);
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writePadding(file, sizeof(header), header.typeOffset);
+        file.write(reinterpret_cast<const char*>(data.types.data()), static_cast<std::streamsize>(header.typeSize));
+        writePadding(file, header.typeOffset + header.typeSize, header.colorOffset);
+        file.write(reinterpret_cast<const char*>(data.colors.data()), static_cast<std::streamsize>(header.colorSize));
+    }
+
+    file.close();
+    if (file.fail())
+    {
+        SASI_LOG_ERROR("failed to write snapshot %s", tempPath.c_str());
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        SASI_LOG_ERROR("failed to replace snapshot %s", path.c_str());
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+sasi::MappedSnapshot::MappedSnapshot()
+    : m_mapping(nullptr)
+    , m_mappingSize(0)
+    , m_header({})
+    , m_types(nullptr)
+    , m_colors(nullptr)
+{
+}
+
+sasi::MappedSnapshot::~MappedSnapshot()
+{
+    close();
+}
+
+bool sasi::MappedSnapshot::open(const std::string& path)
+{
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        SASI_LOG_ERROR("failed to open snapshot %s", path.c_str());
+        return false;
+    }
+
+    struct stat status{};
+    if ((fstat(fd, &status) != 0) || (static_cast<size_t>(status.st_size) < sizeof(SnapshotHeader)))
+    {
+        SASI_LOG_ERROR("%s is too small to be a snapshot", path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    m_mappingSize = static_cast<size_t>(status.st_size);
+    m_mapping = mmap(nullptr, m_mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m_mapping == MAP_FAILED)
+    {
+        SASI_LOG_ERROR("failed to map snapshot %s", path.c_str());
+        m_mapping = nullptr;
+        m_mappingSize = 0;
+        return false;
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(m_mapping);
+    std::memcpy(&m_header, bytes, sizeof(SnapshotHeader));
+
+    const uint64_t cellCount = static_cast<uint64_t>(m_header.width) * m_header.height;
+    const bool isHeaderValid =
+        (std::memcmp(m_header.magic, k_magic, sizeof(k_magic)) == 0)
+        && (m_header.version == k_version)
+        && (m_header.byteOrderMark == k_byteOrderMark)
+        && (m_header.chunkSize == static_cast<uint32_t>(ParticleSimulator::k_chunkSize))
+        && (m_header.typeOffset <= m_mappingSize)
+        && (m_header.typeSize <= m_mappingSize - m_header.typeOffset)
+        && (m_header.colorOffset <= m_mappingSize)
+        && (m_header.colorSize <= m_mappingSize - m_header.colorOffset);
+    if (!isHeaderValid)
+    {
+        SASI_LOG_ERROR("%s is not a snapshot this build can read", path.c_str());
+        close();
+        return false;
+    }
+
+    bool isValid = false;
+    if (m_header.encoding == static_cast<uint32_t>(SnapshotEncoding::Raw))
+    {
+        isValid =
+            (m_header.typeSize == cellCount * sizeof(ParticleType))
+            && (m_header.colorSize == cellCount * sizeof(uint32_t))
+            && ((m_header.colorOffset % alignof(uint32_t)) == 0u);
+        if (isValid)
+        {
+            m_types = reinterpret_cast<const ParticleType*>(bytes + m_header.typeOffset);
+            m_colors = reinterpret_cast<const uint32_t*>(bytes + m_header.colorOffset);
+        }
+    }
+    else if (m_header.encoding == static_cast<uint32_t>(SnapshotEncoding::ChunkRle))
+    {
+        isValid = decodeChunkRle(bytes + m_header.typeOffset, static_cast<size_t>(m_header.typeSize));
+    }
+
+    if (!isValid)
+    {
+        SASI_LOG_ERROR("snapshot %s is truncated or corrupt", path.c_str());
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void sasi::MappedSnapshot::close()
+{
+    if (m_mapping != nullptr)
+    {
+        munmap(m_mapping, m_mappingSize);
+    }
+
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+    m_header = SnapshotHeader{};
+    m_types = nullptr;
+    m_colors = nullptr;
+    m_decodedTypes.clear();
+    m_decodedColors.clear();
+}
+
+int sasi::MappedSnapshot::getWidth() const
+{
+    return static_cast<int>(m_header.width);
+}
+
+int sasi::MappedSnapshot::getHeight() const
+{
+    return static_cast<int>(m_header.height);
+}
+
+uint64_t sasi::MappedSnapshot::getStep() const
+{
+    return m_header.step;
+}
+
+int sasi::MappedSnapshot::getWorldOriginX() const
+{
+    return m_header.worldOriginX;
+}
+
+int sasi::MappedSnapshot::getWorldOriginY() const
+{
+    return m_header.worldOriginY;
+}
+
+sasi::SnapshotEncoding sasi::MappedSnapshot::getEncoding() const
+{
+    return static_cast<SnapshotEncoding>(m_header.encoding);
+}
+
+const sasi::ParticleType* sasi::MappedSnapshot::getTypes() const
+{
+    return m_types;
+}
+
+const uint32_t* sasi::MappedSnapshot::getColors() const
+{
+    return m_colors;
+}
+
+bool sasi::MappedSnapshot::decodeChunkRle(const uint8_t* payload, size_t payloadSize)
+{
+    const int width = static_cast<int>(m_header.width);
+    const int height = static_cast<int>(m_header.height);
+    const int chunkSize = ParticleSimulator::k_chunkSize;
+    const int chunkCountX = (width + chunkSize - 1) / chunkSize;
+    const int chunkCountY = (height + chunkSize - 1) / chunkSize;
+    const size_t chunkCount = static_cast<size_t>(chunkCountX) * chunkCountY;
+
+    const size_t tableSize = (chunkCount + 1) * sizeof(uint64_t);
+    if (payloadSize < tableSize)
+    {
+        return false;
+    }
+    std::vector<uint64_t> offsets(chunkCount + 1);
+    std::memcpy(offsets.data(), payload, tableSize);
+
+    const uint8_t* runs = payload + tableSize;
+    const size_t runsSize = payloadSize - tableSize;
+
+    m_decodedTypes.resize(static_cast<size_t>(width) * height);
+    m_decodedColors.resize(static_cast<size_t>(width) * height);
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        if ((offsets[chunk] > offsets[chunk + 1]) || (offsets[chunk + 1] > runsSize))
+        {
+            return false;
+        }
+
+        const int chunkX = static_cast<int>(chunk % chunkCountX);
+        const int chunkY = static_cast<int>(chunk / chunkCountX);
+        const int minX = chunkX * chunkSize;
+        const int chunkWidth = std::min(minX + chunkSize, width) - minX;
+        const int minY = chunkY * chunkSize;
+        const int cellCount = chunkWidth * (std::min(minY + chunkSize, height) - minY);
+
+        size_t offset = offsets[chunk];
+        const size_t end = offsets[chunk + 1];
+        int cell = 0;
+        while (offset < end)
+        {
+            uint64_t runLength = 0u;
+            int shift = 0;
+            uint8_t byte = 0x80u;
+            while (((byte & 0x80u) != 0u) && (offset < end) && (shift < 64))
+            {
+                byte = runs[offset++];
+                runLength |= static_cast<uint64_t>(byte & 0x7Fu) << shift;
+                shift += 7;
+            }
+            if (((byte & 0x80u) != 0u) || (end - offset < 1 + sizeof(uint32_t)) || (runLength > static_cast<uint64_t>(cellCount - cell)))
+            {
+                return false;
+            }
+
+            const ParticleType type = static_cast<ParticleType>(runs[offset]);
+            uint32_t color;
+            std::memcpy(&color, &runs[offset + 1], sizeof(uint32_t));
+            offset += 1 + sizeof(uint32_t);
+
+            // Fill the run a chunk row segment at a time.
+            int remaining = static_cast<int>(runLength);
+            while (remaining > 0)
+            {
+                const int localX = cell % chunkWidth;
+                const int count = std::min(remaining, chunkWidth - localX);
+                const size_t index = (static_cast<size_t>(minY + (cell / chunkWidth)) * width) + minX + localX;
+                std::fill_n(&m_decodedTypes[index], count, type);
+                std::fill_n(&m_decodedColors[index], count, color);
+                cell += count;
+                remaining -= count;
+            }
+        }
+
+        if (cell != cellCount)
+        {
+            return false;
+        }
+    }
+
+    m_types = m_decodedTypes.data();
+    m_colors = m_decodedColors.data();
+    return true;
+}
+
+bool sasi::loadSnapshot(const std::string& path, ParticleSimulator& simulator)
+{
+    MappedSnapshot snapshot;
+    if (!snapshot.open(path))
+    {
+        return false;
+    }
+
+    if ((snapshot.getWidth() != simulator.getColorDataWidth()) || (snapshot.getHeight() != simulator.getColorDataHeight()))
+    {
+        SASI_LOG_ERROR("snapshot %s holds a %dx%d grid, the simulator is %dx%d", path.c_str(),
+            snapshot.getWidth(), snapshot.getHeight(), simulator.getColorDataWidth(), simulator.getColorDataHeight());
+        return false;
+    }
+
+    simulator.loadCells(snapshot.getTypes(), snapshot.getColors());
+    simulator.setStep(snapshot.getStep());
+    simulator.setWorldOrigin(snapshot.getWorldOriginX(), snapshot.getWorldOriginY());
+    return true;
+}
+
+sasi::SnapshotWriter::~SnapshotWriter()
+{
+    wait();
+}
+
+void sasi::SnapshotWriter::saveAsync(const std::string& path, std::unique_ptr<SnapshotData> data, SnapshotEncoding encoding)
+{
+    wait();
+
+    // The thread owns the data from here on.
+    SnapshotData* ownedData = data.release();
+    m_thread = std::thread([path, ownedData, encoding]()
+    {
+        std::unique_ptr<SnapshotData> threadData{ ownedData };
+        writeSnapshot(path, *threadData, encoding);
+    });
+}
+
+void sasi::SnapshotWriter::wait()
+{
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
@@ -0,0 +1,97 @@
+#include "thread_pool.h"
+
+sasi::ThreadPool::ThreadPool(int threadCount)
+    : m_job(nullptr)
+    , m_jobCount(0)
+    , m_nextJob(0)
+    , m_busyWorkers(0)
+    , m_generation(0ull)
+    , m_isQuitting(false)
+{
+    for (int i = 1; i < threadCount; ++i)
+    {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+sasi::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_isQuitting = true;
+    }
+    m_workAvailable.notify_all();
+
+    for (std::thread& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+int sasi::ThreadPool::getThreadCount() const
+{
+    return static_cast<int>(m_workers.size()) + 1;
+}
+
+void sasi::ThreadPool::parallelFor(int count, const std::function<void(int)>& job)
+{
+    // Not worth waking the workers for a single job.
+    if (m_workers.empty() || (count <= 1))
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            job(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job = &job;
+        m_jobCount = count;
+        m_nextJob.store(0, std::memory_order_relaxed);
+        m_busyWorkers = static_cast<int>(m_workers.size());
+        ++m_generation;
+    }
+    m_workAvailable.notify_all();
+
+    runJobs();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_workFinished.wait(lock, [this]() { return m_busyWorkers == 0; });
+    m_job = nullptr;
+}
+
+void sasi::ThreadPool::workerLoop()
+{
+    uint64_t seenGeneration = 0ull;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_workAvailable.wait(lock, [this, seenGeneration]() { return m_isQuitting || (m_generation != seenGeneration); });
+            if (m_isQuitting)
+            {
+                return;
+            }
+
+            seenGeneration = m_generation;
+        }
+
+        runJobs();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busyWorkers == 0)
+        {
+            m_workFinished.notify_one();
+        }
+    }
+}
+
+void sasi::ThreadPool::runJobs()
+{
+    for (int i = m_nextJob.fetch_add(1); i < m_jobCount; i = m_nextJob.fetch_add(1))
+    {
+        (*m_job)(i);
+    }
+}
@@ -1,7 +1,8 @@
 #include "world.h"
 
 #include <algorithm>
-#include <iostream>
+#include <cmath>
+#include <cstring>
 #include <unordered_set>
 #include <chrono>
 #include <thread>
@@ -12,6 +13,8 @@
 #include "sasi.h"
 
 #include "camera.h"
+#include "log.h"
+#include "material_rules.h"
 #include "shader_util.h"
 #include "engine/input_state.h"
 
@@ -20,13 +23,52 @@ bgfx::VertexLayout sasi::PosUvVertex::ms_layout;
 static const int k_targetFps = 30;
 static const double k_targetFrameTime = 1.0 / k_targetFps;
 
+static sasi::SchedulerOptions makeSchedulerOptions()
+{
+    sasi::SchedulerOptions options;
+    options.fixedDeltaTime = k_targetFrameTime;
+    options.updateBudgetSecs = k_targetFrameTime * 0.5;
+    options.maxStepsPerUpdate = 4;
+    options.maxDeferredSteps = 8;
+    return options;
+}
+
+// Where the quick save and quick load keys keep their snapshot.
+static const char* k_quickSnapshotPath = "world.snapshot";
+
+// Largest brush radius the bracket keys reach, in cells.
+static const int k_maxBrushRadius = 64;
+
+// How much darker the palette render mode shades cells at random, from 0 to 1.
+static const float k_paletteShadeVariation = 0.12f;
+
+static_assert(sasi::Camera::k_minZoom * (1 << (sasi::World::k_levelCount - 1)) == 1.0f,
+    "The last level of detail must match the camera's furthest zoom.");
+
 sasi::World::World(int width, int height, uint64_t startTimeMs, const InputState* inputState)
-    : m_simulator({ 160, 160 })
+    : m_simulator({ width, height })
+    , m_simulationThread(m_simulator, makeSchedulerOptions())
+    , m_renderMode(RenderMode::Color)
     , m_camera(new Camera{ 0.0f, 100.0f })
     , m_inputState(inputState)
     , m_startTimeMs(startTimeMs)
     , m_previousTickTimeSecs(0.0)
-    , m_fixedTimeAccumulationSecs(0.0)
+    , m_brushType(ParticleType::Sand)
+    , m_brushRadius(0)
+    , m_materialTypes({})
+    , m_palette({})
+    , m_isPaletteNew(false)
+    , m_isBrushDown(false)
+    , m_previousBrushX(0.0f)
+    , m_previousBrushY(0.0f)
+    , m_schedulerStats({})
+    , m_metrics({})
+    , m_streamingStats({})
+    , m_worldOriginX(0)
+    , m_worldOriginY(0)
+    , m_lodPyramid(m_simulator.getColorDataWidth(), m_simulator.getColorDataHeight(), k_levelCount)
+    , m_levels(k_levelCount)
+    , m_dirtyRects({})
 {
     PosUvVertex::init();
     m_vbh = bgfx::createVertexBuffer(
@@ -40,36 +82,98 @@ sasi::World::World(int width, int height, uint64_t startTimeMs, const InputState
     bgfx::ShaderHandle vsh{};
     if (!loadShader(vsh, "bin/shaders/v_simple.bin"))
     {
-        std::cout << "SASI: World initialization failure. Failed to load vertex shader.\n";
+        SASI_LOG_ERROR("World initialization failure. Failed to load vertex shader.");
     }
     bgfx::ShaderHandle fsh{};
     if (!loadShader(fsh, "bin/shaders/f_simple.bin"))
     {
-        std::cout << "SASI: World initialization failure. Failed to load fragment shader.\n";
+        SASI_LOG_ERROR("World initialization failure. Failed to load fragment shader.");
+    }
+    bgfx::ShaderHandle paletteFsh{};
+    if (!loadShader(paletteFsh, "bin/shaders/f_palette.bin"))
+    {
+        SASI_LOG_ERROR("World initialization failure. Failed to load palette fragment shader.");
     }
+    m_palettePh = bgfx::createProgram(vsh, paletteFsh, false);
     m_ph = bgfx::createProgram(vsh, fsh, true);
 
-    // Create the texture we'll use to render the world.
-    m_textureHandle = bgfx::createTexture2D(
-        width,
-        height,
+    // Every tile starts out needing all of its cells uploaded. Their textures are made when
+    // they first come into view, so worlds far larger than the screen cost nothing until seen.
+    for (int level = 0; level < k_levelCount; ++level)
+    {
+        WorldLevel& worldLevel = m_levels[level];
+        worldLevel.tileCountX = (m_lodPyramid.getLevelWidth(level) + k_tileSize - 1) / k_tileSize;
+        worldLevel.tileCountY = (m_lodPyramid.getLevelHeight(level) + k_tileSize - 1) / k_tileSize;
+        worldLevel.tiles.resize(static_cast<size_t>(worldLevel.tileCountX) * worldLevel.tileCountY);
+    }
+    markAllTilesPending();
+
+    // Levels above the cells start out zeroed and are only ever updated where a step changed
+    // something, so fill them from the world the simulation thread started with. Should the
+    // frame already be a fresh one, the steps it lists are covered too, and the stats it
+    // carries are replaced by the next.
+    bool isNewFrame = false;
+    const SimulationFrame& frame = m_simulationThread.acquireFrame(isNewFrame);
+    const int dataWidth = m_simulator.getColorDataWidth();
+    const int dataHeight = m_simulator.getColorDataHeight();
+    m_lodPyramid.update(frame.colorData.get(), frame.typeData.get(), dataWidth, DirtyRect{ 0, 0, dataWidth - 1, dataHeight - 1 });
+
+    // Create sampler to use with texture.
+    m_textureSampler = bgfx::createUniform(
+        "s_texColor",
+        bgfx::UniformType::Sampler);
+
+    // The palette render mode's colour of each type.
+    m_paletteTextureHandle = bgfx::createTexture2D(
+        ParticleRegistry::k_maxParticleTypes,
+        1,
         false,
         0,
         bgfx::TextureFormat::RGBA8,
         BGFX_TEXTURE_NONE,
         nullptr
     );
-
-    // Create sampler to use with texture.
-    m_textureSampler = bgfx::createUniform(
-        "s_texColor",
+    m_typeSampler = bgfx::createUniform(
+        "s_texType",
+        bgfx::UniformType::Sampler);
+    m_paletteSampler = bgfx::createUniform(
+        "s_texPalette",
         bgfx::UniformType::Sampler);
+    m_paletteParams = bgfx::createUniform(
+        "u_paletteParams",
+        bgfx::UniformType::Vec4);
+    m_paletteOffset = bgfx::createUniform(
+        "u_paletteOffset",
+        bgfx::UniformType::Vec4);
+    requestPalette();
 }
 
 sasi::World::~World()
 {
+    // Queued commands reach into members destroyed before the thread would be.
+    m_simulationThread.stop();
+
+    for (const WorldLevel& level : m_levels)
+    {
+        for (const WorldTile& tile : level.tiles)
+        {
+            if (bgfx::isValid(tile.colorTexture))
+            {
+                bgfx::destroy(tile.colorTexture);
+            }
+            if (bgfx::isValid(tile.typeTexture))
+            {
+                bgfx::destroy(tile.typeTexture);
+            }
+        }
+    }
+    bgfx::destroy(m_paletteOffset);
+    bgfx::destroy(m_paletteParams);
+    bgfx::destroy(m_paletteSampler);
+    bgfx::destroy(m_typeSampler);
+    bgfx::destroy(m_paletteTextureHandle);
+    bgfx::destroy(m_palettePh);
     bgfx::destroy(m_textureSampler);
-    bgfx::destroy(m_textureHandle);
     bgfx::destroy(m_ph);
     bgfx::destroy(m_ibh);
     bgfx::destroy(m_vbh);
@@ -79,13 +183,13 @@ void sasi::World::tick(int frame, uint64_t elapsedTimeMs)
 {
     if (m_inputState == nullptr)
     {
-        std::cout << "SASI (ERROR): world is missing input state.\n";
+        SASI_LOG_ERROR("world is missing input state.");
         return;
     }
 
     if (m_camera.get() == nullptr)
     {
-        std::cout << "SASI (ERROR): world is missing camera.\n";
+        SASI_LOG_ERROR("world is missing camera.");
         return;
     }
 
@@ -93,7 +197,6 @@ void sasi::World::tick(int frame, uint64_t elapsedTimeMs)
     double deltaTimeSecs = elapsedTimeSecs - m_previousTickTimeSecs;
 
     m_previousTickTimeSecs = elapsedTimeSecs;
-    m_fixedTimeAccumulationSecs += deltaTimeSecs;
 
     const float cameraSpeed = 5.0f;
     if (m_inputState->isKeyDownThisFrame(SDLK_i))
@@ -104,6 +207,50 @@ void sasi::World::tick(int frame, uint64_t elapsedTimeMs)
     {
         m_camera->zoomOut();
     }
+    if (m_inputState->isKeyDownThisFrame(SDLK_p))
+    {
+        setRenderMode((m_renderMode == RenderMode::Color) ? RenderMode::Palette : RenderMode::Color);
+    }
+    if (m_inputState->isKeyDownThisFrame(SDLK_1))
+    {
+        m_brushType = ParticleType::Sand;
+    }
+    if (m_inputState->isKeyDownThisFrame(SDLK_2))
+    {
+        m_brushType = ParticleType::Water;
+    }
+    if (m_inputState->isKeyDownThisFrame(SDLK_3))
+    {
+        m_brushType = ParticleType::Void;
+    }
+    if (m_inputState->isKeyDownThisFrame(SDLK_4))
+    {
+        std::lock_guard<std::mutex> lock(m_materialMutex);
+        if (!m_materialTypes.empty())
+        {
+            // Start from the first material unless the brush already holds one.
+            auto current = std::find(m_materialTypes.begin(), m_materialTypes.end(), m_brushType);
+            m_brushType = ((current == m_materialTypes.end()) || (current + 1 == m_materialTypes.end()))
+                ? m_materialTypes.front()
+                : *(current + 1);
+        }
+    }
+    if (m_inputState->isKeyDownThisFrame(SDLK_LEFTBRACKET))
+    {
+        m_brushRadius = std::max(m_brushRadius - 1, 0);
+    }
+    if (m_inputState->isKeyDownThisFrame(SDLK_RIGHTBRACKET))
+    {
+        m_brushRadius = std::min(m_brushRadius + 1, k_maxBrushRadius);
+    }
+    if (m_inputState->isKeyDownThisFrame(SDLK_F5))
+    {
+        saveSnapshot(k_quickSnapshotPath);
+    }
+    if (m_inputState->isKeyDownThisFrame(SDLK_F9))
+    {
+        loadSnapshot(k_quickSnapshotPath);
+    }
     if (m_inputState->isKeyDown(SDLK_d))
     {
         m_camera->translate(bx::mul(bx::Vec3{ 1.0f, 0.0f, 0.0f }, cameraSpeed * deltaTimeSecs ));
@@ -126,66 +273,449 @@ void sasi::World::tick(int frame, uint64_t elapsedTimeMs)
         int x, y;
         m_inputState->getMouseLocation(x, y);
         const bx::Vec3 mouseWorldLocation = m_camera->screenToWorldLocation(m_backbufferWidth, m_backbufferHeight, x, y);
-        m_simulator.makeParticleAtWorldLocation(ParticleType::Sand, mouseWorldLocation);
-    }
+        InputEvent event;
+        event.kind = InputEventKind::Stroke;
+        event.particleType = m_brushType;
+        event.worldX = m_isBrushDown ? m_previousBrushX : mouseWorldLocation.x;
+        event.worldY = m_isBrushDown ? m_previousBrushY : mouseWorldLocation.y;
+        event.toWorldX = mouseWorldLocation.x;
+        event.toWorldY = mouseWorldLocation.y;
+        event.radius = m_brushRadius / k_pixelsPerUnit;
+        event.seed = static_cast<uint32_t>(frame);
+        m_simulationThread.enqueueInput(event);
 
-    // Run fixed update simulation.
-    while (m_fixedTimeAccumulationSecs >= k_targetFrameTime)
+        m_isBrushDown = true;
+        m_previousBrushX = mouseWorldLocation.x;
+        m_previousBrushY = mouseWorldLocation.y;
+    }
+    else
     {
-        m_simulator.tick(k_targetFrameTime);
-
-        m_fixedTimeAccumulationSecs -= k_targetFrameTime;
+        m_isBrushDown = false;
     }
+
+    // Keep the streamed region centred on the camera. World cells count down the screen.
+    const bx::Vec3& cameraLocation = m_camera->getLocation();
+    m_simulationThread.setStreamingFocus(cameraLocation.x * k_pixelsPerUnit, -cameraLocation.y * k_pixelsPerUnit);
+
+    // The fixed update simulation runs on the simulation thread.
 }
 
 void sasi::World::render(int frame, bgfx::ViewId viewId)
 {
     if (m_camera.get() == nullptr)
     {
-        std::cout << "SASI (ERROR): World:: failed to render as camera is null.\n";
+        SASI_LOG_ERROR("World:: failed to render as camera is null.");
         return;
     }
 
+    uploadPalette();
+
     float view[16];
     m_camera->getView(view);
     float proj[16];
     m_camera->getproj(proj, m_backbufferWidth, m_backbufferHeight);
     bgfx::setViewTransform(viewId, view, proj);
 
-    // Set render states.
-    bgfx::setState(BGFX_STATE_DEFAULT);
+    // Upload first, the frame decides where in the world the tiles go. Only the level that
+    // matches the zoom is used, and of its tiles only those in view.
+    const int level = pickLevel();
+    int minTileX = 0;
+    int minTileY = 0;
+    int maxTileX = -1;
+    int maxTileY = -1;
+    findVisibleTiles(level, minTileX, minTileY, maxTileX, maxTileY);
+    uploadTiles(level, minTileX, minTileY, maxTileX, maxTileY);
+
+    const bool isPalette = m_renderMode == RenderMode::Palette;
+    const WorldLevel& worldLevel = m_levels[level];
+    for (int tileY = minTileY; tileY <= maxTileY; ++tileY)
+    {
+        for (int tileX = minTileX; tileX <= maxTileX; ++tileX)
+        {
+            const WorldTile& tile = worldLevel.tiles[(tileY * worldLevel.tileCountX) + tileX];
+            const DirtyRect bounds = getTileBounds(level, tileX, tileY);
+
+            // Set render states.
+            bgfx::setState(BGFX_STATE_DEFAULT);
+
+            // Set model matrix. The quad covers the cells under the tile's texels, with the
+            // grid's top left at the world origin of the frame.
+            const float tileWidth = static_cast<float>(bounds.getWidth() << level);
+            const float tileHeight = static_cast<float>(bounds.getHeight() << level);
+            float mtxScale[16];
+            bx::mtxScale(mtxScale, tileWidth / k_pixelsPerUnit, tileHeight / k_pixelsPerUnit, 1.0f);
+            float mtxTranslate[16];
+            bx::mtxTranslate(
+                mtxTranslate,
+                (m_worldOriginX + (bounds.minX << level)) / tileWidth,
+                -1.0f - ((m_worldOriginY + (bounds.minY << level)) / tileHeight),
+                0.0f);
+            float mtxTransform[16];
+            bx::mtxMul(mtxTransform, mtxTranslate, mtxScale);
+            bgfx::setTransform(mtxTransform);
+
+            bgfx::setVertexBuffer(0, m_vbh);
+            bgfx::setIndexBuffer(m_ibh);
+
+            if (isPalette)
+            {
+                // Shades are hashed from the level's texels, so they carry on across tile edges.
+                const float paletteParams[4] = {
+                    k_paletteShadeVariation,
+                    static_cast<float>(bounds.getWidth()),
+                    static_cast<float>(bounds.getHeight()),
+                    0.0f };
+                bgfx::setUniform(m_paletteParams, paletteParams);
+                const float paletteOffset[4] = { static_cast<float>(bounds.minX), static_cast<float>(bounds.minY), 0.0f, 0.0f };
+                bgfx::setUniform(m_paletteOffset, paletteOffset);
+
+                // Bind textures.
+                bgfx::setTexture(0, m_typeSampler, tile.typeTexture, BGFX_SAMPLER_POINT);
+                bgfx::setTexture(1, m_paletteSampler, m_paletteTextureHandle, BGFX_SAMPLER_POINT);
+
+                // Submit primitive for rendering.
+                bgfx::submit(viewId, m_palettePh);
+                continue;
+            }
+
+            // Bind texture.
+            bgfx::setTexture(0, m_textureSampler, tile.colorTexture, BGFX_SAMPLER_POINT);
+
+            // Submit primitive for rendering.
+            bgfx::submit(viewId, m_ph);
+        }
+    }
+}
+
+void sasi::World::uploadTiles(int level, int minTileX, int minTileY, int maxTileX, int maxTileY)
+{
+    const int dataWidth = m_simulator.getColorDataWidth();
+
+    bool isNewFrame = false;
+    const SimulationFrame& frame = m_simulationThread.acquireFrame(isNewFrame);
 
-    // Set model matrix.
-    float mtxScale[16];
-    bx::mtxScale(mtxScale, 20.0f, 20.0f, 1.0f);
-    float mtxTranslate[16];
-    bx::mtxTranslate(mtxTranslate, 0.0f, -1.0f, 0.0f);
-    float mtxTransform[16];
-    bx::mtxMul(mtxTransform, mtxTranslate, mtxScale);
-    bgfx::setTransform(mtxTransform);
+    m_dirtyRects.clear();
+    if (isNewFrame)
+    {
+        m_dirtyRects = frame.dirtyRects;
+        m_schedulerStats = frame.schedulerStats;
+        m_metrics = frame.metrics;
+        m_streamingStats = frame.streamingStats;
+        m_worldOriginX = frame.worldOriginX;
+        m_worldOriginY = frame.worldOriginY;
+    }
 
-    bgfx::setVertexBuffer(0, m_vbh);
-    bgfx::setIndexBuffer(m_ibh);
+    // Bring the pyramid up to date and hand every changed region to the tiles it overlaps on
+    // every level, seen or not.
+    for (const DirtyRect& rect : m_dirtyRects)
+    {
+        m_lodPyramid.update(frame.colorData.get(), frame.typeData.get(), dataWidth, rect);
+
+        for (int rectLevel = 0; rectLevel < k_levelCount; ++rectLevel)
+        {
+            WorldLevel& worldLevel = m_levels[rectLevel];
+            const DirtyRect levelRect = LodPyramid::toLevel(rect, rectLevel);
+            for (int tileY = levelRect.minY / k_tileSize; tileY <= levelRect.maxY / k_tileSize; ++tileY)
+            {
+                for (int tileX = levelRect.minX / k_tileSize; tileX <= levelRect.maxX / k_tileSize; ++tileX)
+                {
+                    const DirtyRect bounds = getTileBounds(rectLevel, tileX, tileY);
+                    worldLevel.tiles[(tileY * worldLevel.tileCountX) + tileX].pending.expand(
+                        std::max(levelRect.minX, bounds.minX),
+                        std::max(levelRect.minY, bounds.minY),
+                        std::min(levelRect.maxX, bounds.maxX),
+                        std::min(levelRect.maxY, bounds.maxY));
+                }
+            }
+        }
+    }
+
+    // All planes are laid out alike, only the size of a cell and the row length differ.
+    const bool isPalette = m_renderMode == RenderMode::Palette;
+    const uint8_t* data = nullptr;
+    if (level == 0)
+    {
+        data = isPalette
+            ? reinterpret_cast<const uint8_t*>(frame.typeData.get())
+            : reinterpret_cast<const uint8_t*>(frame.colorData.get());
+    }
+    else
+    {
+        data = isPalette
+            ? reinterpret_cast<const uint8_t*>(m_lodPyramid.getTypes(level))
+            : reinterpret_cast<const uint8_t*>(m_lodPyramid.getColors(level));
+    }
+    const size_t cellBytes = isPalette ? sizeof(ParticleType) : sizeof(uint32_t);
+    const size_t levelWidth = static_cast<size_t>(m_lodPyramid.getLevelWidth(level));
+
+    WorldLevel& worldLevel = m_levels[level];
+    for (int tileY = minTileY; tileY <= maxTileY; ++tileY)
+    {
+        for (int tileX = minTileX; tileX <= maxTileX; ++tileX)
+        {
+            WorldTile& tile = worldLevel.tiles[(tileY * worldLevel.tileCountX) + tileX];
+            const DirtyRect bounds = getTileBounds(level, tileX, tileY);
+
+            bgfx::TextureHandle& textureHandle = isPalette ? tile.typeTexture : tile.colorTexture;
+            if (!bgfx::isValid(textureHandle))
+            {
+                textureHandle = bgfx::createTexture2D(
+                    static_cast<uint16_t>(bounds.getWidth()),
+                    static_cast<uint16_t>(bounds.getHeight()),
+                    false,
+                    0,
+                    isPalette ? bgfx::TextureFormat::R8 : bgfx::TextureFormat::RGBA8,
+                    BGFX_TEXTURE_NONE,
+                    nullptr
+                );
+                tile.pending = bounds;
+            }
+
+            const DirtyRect rect = tile.pending;
+            if (rect.isEmpty())
+            {
+                continue;
+            }
+            tile.pending = DirtyRect{};
+
+            // Pack the rect's rows together. bgfx consumes the copy later, by which time we may
+            // have handed the frame back to the simulation thread.
+            const uint32_t rowBytes = static_cast<uint32_t>(rect.getWidth() * cellBytes);
+            const bgfx::Memory* memory = bgfx::alloc(rowBytes * rect.getHeight());
+            for (int y = rect.minY; y <= rect.maxY; ++y)
+            {
+                std::memcpy(
+                    memory->data + (static_cast<size_t>(y - rect.minY) * rowBytes),
+                    data + (((static_cast<size_t>(y) * levelWidth) + rect.minX) * cellBytes),
+                    rowBytes);
+            }
+
+            bgfx::updateTexture2D(
+                textureHandle,
+                0, // Layer
+                0, // Mip level
+                static_cast<uint16_t>(rect.minX - bounds.minX), // X offset
+                static_cast<uint16_t>(rect.minY - bounds.minY), // Y offset
+                static_cast<uint16_t>(rect.getWidth()), // Width of the new data
+                static_cast<uint16_t>(rect.getHeight()), // Height of the new data
+                memory);
+        }
+    }
+}
+
+bool sasi::World::findVisibleTiles(int level, int& outMinTileX, int& outMinTileY, int& outMaxTileX, int& outMaxTileY) const
+{
+    float minX = 0.0f;
+    float minY = 0.0f;
+    float maxX = 0.0f;
+    float maxY = 0.0f;
+    m_camera->getViewBounds(m_backbufferWidth, m_backbufferHeight, minX, minY, maxX, maxY);
+
+    // Grid cells count down the screen from the world origin of the latest frame.
+    const int minCellX = static_cast<int>(std::floor(minX * k_pixelsPerUnit)) - m_worldOriginX;
+    const int maxCellX = static_cast<int>(std::ceil(maxX * k_pixelsPerUnit)) - m_worldOriginX;
+    const int minCellY = static_cast<int>(std::floor(-maxY * k_pixelsPerUnit)) - m_worldOriginY;
+    const int maxCellY = static_cast<int>(std::ceil(-minY * k_pixelsPerUnit)) - m_worldOriginY;
+
+    const int dataWidth = m_simulator.getColorDataWidth();
+    const int dataHeight = m_simulator.getColorDataHeight();
+    if ((maxCellX < 0) || (maxCellY < 0) || (minCellX >= dataWidth) || (minCellY >= dataHeight))
+    {
+        return false;
+    }
+
+    const DirtyRect visible = LodPyramid::toLevel(
+        DirtyRect{ std::max(minCellX, 0), std::max(minCellY, 0), std::min(maxCellX, dataWidth - 1), std::min(maxCellY, dataHeight - 1) },
+        level);
+    outMinTileX = visible.minX / k_tileSize;
+    outMinTileY = visible.minY / k_tileSize;
+    outMaxTileX = visible.maxX / k_tileSize;
+    outMaxTileY = visible.maxY / k_tileSize;
+    return true;
+}
+
+int sasi::World::pickLevel() const
+{
+    const float zoom = m_camera->getZoom();
+    int level = 0;
+    while ((level + 1 < k_levelCount) && (zoom * static_cast<float>(1 << (level + 1)) <= 1.0f))
+    {
+        ++level;
+    }
+    return level;
+}
+
+void sasi::World::markAllTilesPending()
+{
+    for (int level = 0; level < k_levelCount; ++level)
+    {
+        WorldLevel& worldLevel = m_levels[level];
+        for (int tileY = 0; tileY < worldLevel.tileCountY; ++tileY)
+        {
+            for (int tileX = 0; tileX < worldLevel.tileCountX; ++tileX)
+            {
+                worldLevel.tiles[(tileY * worldLevel.tileCountX) + tileX].pending = getTileBounds(level, tileX, tileY);
+            }
+        }
+    }
+}
+
+sasi::DirtyRect sasi::World::getTileBounds(int level, int tileX, int tileY) const
+{
+    const int minX = tileX * k_tileSize;
+    const int minY = tileY * k_tileSize;
+    return DirtyRect{
+        minX,
+        minY,
+        std::min(minX + k_tileSize, m_lodPyramid.getLevelWidth(level)) - 1,
+        std::min(minY + k_tileSize, m_lodPyramid.getLevelHeight(level)) - 1 };
+}
+
+void sasi::World::publishPalette(const ParticleSimulator& simulator)
+{
+    std::array<uint32_t, ParticleRegistry::k_maxParticleTypes> palette;
+    simulator.buildPalette(palette.data());
+
+    std::lock_guard<std::mutex> lock(m_materialMutex);
+    m_palette = palette;
+    m_isPaletteNew = true;
+}
+
+void sasi::World::requestPalette()
+{
+    m_simulationThread.enqueue([this](ParticleSimulator& simulator)
+    {
+        publishPalette(simulator);
+    });
+}
+
+void sasi::World::uploadPalette()
+{
+    const bgfx::Memory* memory = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_materialMutex);
+        if (!m_isPaletteNew)
+        {
+            return;
+        }
+
+        memory = bgfx::copy(m_palette.data(), static_cast<uint32_t>(m_palette.size() * sizeof(uint32_t)));
+        m_isPaletteNew = false;
+    }
 
     bgfx::updateTexture2D(
-        m_textureHandle,
+        m_paletteTextureHandle,
+        0, // Layer
         0, // Mip level
         0, // X offset
         0, // Y offset
-        0, // Z offset (for 3D textures)
-        m_simulator.getColorDataWidth(), // Width of the new data
-        m_simulator.getColorDataHeight(), // Height of the new data
-        bgfx::makeRef(static_cast<const void*>(m_simulator.getColorData()), m_simulator.getColorDataSize()));
-
-    // Bind texture.
-    bgfx::setTexture(0, m_textureSampler, m_textureHandle, BGFX_SAMPLER_POINT);
-
-    // Submit primitive for rendering.
-    bgfx::submit(viewId, m_ph);
+        static_cast<uint16_t>(ParticleRegistry::k_maxParticleTypes), // Width of the new data
+        1, // Height of the new data
+        memory);
 }
 
 void sasi::World::updateBackbufferWidthHeight(int width, int height)
 {
     m_backbufferWidth = width;
     m_backbufferHeight = height;
+}
+
+void sasi::World::setRenderMode(RenderMode renderMode)
+{
+    if (renderMode == m_renderMode)
+    {
+        return;
+    }
+
+    m_renderMode = renderMode;
+
+    // The textures we are switching to missed every change made while they were unused.
+    markAllTilesPending();
+    const bool isColorOutputEnabled = renderMode == RenderMode::Color;
+    m_simulationThread.enqueue([isColorOutputEnabled](ParticleSimulator& simulator)
+    {
+        simulator.setColorOutputEnabled(isColorOutputEnabled);
+    });
+}
+
+sasi::RenderMode sasi::World::getRenderMode() const
+{
+    return m_renderMode;
+}
+
+void sasi::World::openMetricsCsv(const std::string& path)
+{
+    m_simulationThread.openMetricsCsv(path);
+}
+
+void sasi::World::saveSnapshot(const std::string& path)
+{
+    m_simulationThread.saveSnapshot(path, SnapshotEncoding::Raw);
+}
+
+void sasi::World::loadSnapshot(const std::string& path)
+{
+    m_simulationThread.loadSnapshot(path);
+}
+
+void sasi::World::enableStreaming(const std::string& pageFilePath)
+{
+    StreamingOptions options;
+    options.pageFilePath = pageFilePath;
+    m_simulationThread.enableStreaming(options);
+}
+
+bool sasi::World::loadMaterials(const std::string& path)
+{
+    std::vector<MaterialDefinition> definitions;
+    if (!loadMaterialDefinitions(path, definitions))
+    {
+        return false;
+    }
+
+    m_simulationThread.enqueue([this, definitions](ParticleSimulator& simulator)
+    {
+        for (const MaterialDefinition& definition : definitions)
+        {
+            const ParticleType type = simulator.registerMaterial(definition);
+            if (type == ParticleType::Max)
+            {
+                SASI_LOG_ERROR("no room to register material %s", definition.name.c_str());
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(m_materialMutex);
+            m_materialTypes.push_back(type);
+        }
+
+        // The palette texture is refreshed whatever the render mode, so switching to palette
+        // mode later finds the new colours already there.
+        publishPalette(simulator);
+    });
+    return true;
+}
+
+void sasi::World::startRecording(const std::string& path)
+{
+    m_simulationThread.startRecording(path);
+}
+
+bool sasi::World::startReplay(const std::string& path)
+{
+    return m_simulationThread.startReplay(path);
+}
+
+const sasi::SchedulerStats& sasi::World::getSchedulerStats() const
+{
+    return m_schedulerStats;
+}
+
+const sasi::MetricsSummary& sasi::World::getMetrics() const
+{
+    return m_metrics;
+}
+
+const sasi::StreamingStats& sasi::World::getStreamingStats() const
+{
+    return m_streamingStats;
 }
\ No newline at end of file